@@ -0,0 +1,424 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/spsc_queue.hpp"
+#include "pseye/driver/usb_transfer_controller.hpp"
+#include "pseye/log.hpp"
+
+#include <libusb.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Feeds synthetic completions through usb_transfer_controller's own transfer callback (and with it process_done())
+// and, for comparison, through a copy of the completion path before it went lock-free: a std::function data handler
+// and a mutex plus a search of all transfers to retire one.
+// The libusb calls that need a device are replaced below, a submitted transfer simply completes after the ones before
+// it. The resubmit is part of the measurement, the kernel's share of it isn't.
+
+using namespace pseye;
+using bench_clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr std::size_t num_completions = 2'000'000;
+// Completions with a final status need fresh transfers, so they're measured in rounds of |num_transfers|
+constexpr std::size_t num_rounds = 20'000;
+constexpr std::size_t num_transfers = 16;
+constexpr std::size_t transfer_size = 65536;
+constexpr std::size_t num_spare_buffers = 4;
+constexpr std::size_t num_iso_packets = 32;
+constexpr std::size_t iso_packet_size = 3072;
+
+// Stands in for libusb's event handling: transfers complete in the order they were submitted
+struct fake_event_loop
+{
+  std::array<libusb_transfer*, 256> ring{};
+  std::size_t head = 0;
+  std::size_t tail = 0;
+
+  bool empty() const { return head == tail; }
+  void submit(libusb_transfer* transfer) { ring[tail++ % ring.size()] = transfer; }
+
+  bool remove(libusb_transfer* transfer)
+  {
+    for (auto i = head; i != tail; ++i) {
+      if (ring[i % ring.size()] != transfer)
+        continue;
+      for (auto j = i + 1; j != tail; ++j)
+        ring[(j - 1) % ring.size()] = ring[j % ring.size()];
+      --tail;
+      return true;
+    }
+    return false;
+  }
+
+  // Completes the oldest in-flight transfer
+  void complete(libusb_transfer_status status)
+  {
+    const auto transfer = ring[head++ % ring.size()];
+    transfer->status = status;
+    transfer->actual_length = status == LIBUSB_TRANSFER_COMPLETED ? transfer->length : 0;
+    transfer->callback(transfer);
+  }
+
+  // Mostly full packets with the occasional empty one; failed ones would only measure the old error logging
+  void fill_iso_packets()
+  {
+    for (auto i = head; i != tail; ++i) {
+      const auto transfer = ring[i % ring.size()];
+      for (int packet = 0; packet < transfer->num_iso_packets; ++packet)
+        transfer->iso_packet_desc[packet].actual_length = packet % 8 == 7 ? 0 : iso_packet_size;
+    }
+  }
+};
+
+fake_event_loop event_loop;
+
+} // namespace
+
+extern "C" {
+
+int LIBUSB_CALL libusb_submit_transfer(libusb_transfer* transfer)
+{
+  event_loop.submit(transfer);
+  return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_cancel_transfer(libusb_transfer* transfer)
+{
+  if (!event_loop.remove(transfer))
+    return LIBUSB_ERROR_NOT_FOUND;
+
+  transfer->status = LIBUSB_TRANSFER_CANCELLED;
+  transfer->actual_length = 0;
+  transfer->callback(transfer);
+  return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_clear_halt(libusb_device_handle*, unsigned char)
+{
+  return LIBUSB_SUCCESS;
+}
+
+} // extern "C"
+
+namespace
+{
+
+// usb_transfer_controller's completion path before it went lock-free
+class locked_completion_path
+{
+public:
+  explicit locked_completion_path(std::function<void(std::span<std::uint8_t> data)> handler)
+    : handler_(std::move(handler))
+  {
+  }
+
+  void start(const usb_transfer_settings& settings)
+  {
+    std::lock_guard lock(active_transfers_mutex_);
+    buffer_.resize(settings.transfer_size * settings.num_transfers);
+    transfers_.resize(settings.num_transfers);
+
+    const auto num_iso_packets = static_cast<int>(settings.num_iso_packets);
+    const auto size = static_cast<int>(settings.transfer_size);
+    const auto on_transfer_done = [](libusb_transfer* transfer) {
+      static_cast<locked_completion_path*>(transfer->user_data)->process_done(transfer);
+    };
+
+    for (std::size_t index = 0; index < settings.num_transfers; ++index) {
+      const auto transfer = ::libusb_alloc_transfer(num_iso_packets);
+      transfers_[index].reset(transfer);
+
+      const auto buffer = &buffer_[index * settings.transfer_size];
+      if (num_iso_packets == 0) {
+        ::libusb_fill_bulk_transfer(transfer, nullptr, settings.endpoint, buffer, size, on_transfer_done, this, 0);
+      } else {
+        ::libusb_fill_iso_transfer(transfer, nullptr, settings.endpoint, buffer, size, num_iso_packets,
+                                   on_transfer_done, this, 0);
+        ::libusb_set_iso_packet_lengths(transfer, size / num_iso_packets);
+      }
+
+      ::libusb_submit_transfer(transfer);
+      num_active_transfers_++;
+    }
+  }
+
+private:
+  void free_transfer(libusb_transfer* transfer)
+  {
+    std::lock_guard lock(active_transfers_mutex_);
+    --num_active_transfers_;
+
+    const auto it = std::find_if(std::begin(transfers_), std::end(transfers_), [transfer](const auto& p) {
+      return p.get() == transfer;
+    });
+    if (it != std::end(transfers_)) {
+      it->reset();
+    } else {
+      PSEYE_LOG_ERROR("transfer {} not found", static_cast<void*>(transfer));
+    }
+
+    transfer_done_condition_.notify_one();
+  }
+
+  void process_done(libusb_transfer* transfer)
+  {
+    bool resubmit = true;
+
+    switch (transfer->status) {
+      case LIBUSB_TRANSFER_COMPLETED:
+        if (transfer->num_iso_packets == 0) {
+          handler_(std::span(transfer->buffer, transfer->actual_length));
+        } else {
+          for (int packet_id = 0; packet_id < transfer->num_iso_packets; ++packet_id) {
+            const auto& pkt = transfer->iso_packet_desc[packet_id];
+            if (pkt.status == LIBUSB_TRANSFER_COMPLETED) {
+              if (pkt.actual_length != 0) {
+                const auto pkt_buf = ::libusb_get_iso_packet_buffer_simple(transfer, packet_id);
+                handler_(std::span(pkt_buf, pkt.actual_length));
+              }
+              continue;
+            }
+            PSEYE_LOG_ERROR("bad iso packet: status {} {}", static_cast<int>(pkt.status),
+                            ::libusb_error_name(pkt.status));
+          }
+        }
+        break;
+      case LIBUSB_TRANSFER_CANCELLED:
+      case LIBUSB_TRANSFER_ERROR:
+      case LIBUSB_TRANSFER_NO_DEVICE:
+        PSEYE_LOG_DEBUG("not retrying transfer: status {} {}", static_cast<int>(transfer->status),
+                        ::libusb_error_name(transfer->status));
+        free_transfer(transfer);
+        resubmit = false;
+        break;
+      case LIBUSB_TRANSFER_TIMED_OUT:
+      case LIBUSB_TRANSFER_STALL:
+      case LIBUSB_TRANSFER_OVERFLOW:
+        PSEYE_LOG_DEBUG("retrying transfer with: status {} {}", static_cast<int>(transfer->status),
+                        ::libusb_error_name(transfer->status));
+        break;
+    }
+
+    if (resubmit) {
+      const int ret = ::libusb_submit_transfer(transfer);
+      if (ret != LIBUSB_SUCCESS) {
+        free_transfer(transfer);
+        PSEYE_LOG_ERROR("failed re-submit of transfer with: {} {}", ret, ::libusb_error_name(ret));
+      }
+    }
+  }
+
+  std::function<void(std::span<std::uint8_t> data)> handler_;
+  std::vector<std::uint8_t> buffer_;
+  std::vector<std::unique_ptr<libusb_transfer, free_libusb_transfer>> transfers_;
+
+  std::mutex active_transfers_mutex_;
+  std::condition_variable transfer_done_condition_;
+  std::uint8_t num_active_transfers_ = 0;
+};
+
+struct result
+{
+  bench_clock::duration elapsed{};
+  std::size_t completions = 0;
+};
+
+void report(const char* name, const result& lock_free, const result* locked)
+{
+  const auto ns = [](const result& r) {
+    return std::chrono::duration<double, std::nano>(r.elapsed).count() / static_cast<double>(r.completions);
+  };
+  if (locked)
+    std::printf("%-24s %10.1f ns %14.1f ns\n", name, ns(lock_free), ns(*locked));
+  else
+    std::printf("%-24s %10.1f ns %17s\n", name, ns(lock_free), "n/a");
+}
+
+usb_transfer_settings make_settings(std::size_t iso_packets, std::size_t max_recovery_attempts = 3)
+{
+  usb_transfer_settings settings;
+  settings.endpoint = 0x81;
+  settings.num_transfers = num_transfers;
+  settings.transfer_size = iso_packets == 0 ? transfer_size : iso_packets * iso_packet_size;
+  settings.num_iso_packets = iso_packets;
+  settings.max_recovery_attempts = max_recovery_attempts;
+  return settings;
+}
+
+void count_bytes(void* ctx, std::span<std::uint8_t> data)
+{
+  *static_cast<std::size_t*>(ctx) += data.size();
+}
+
+template <typename Start>
+result run_completed(Start&& start)
+{
+  start();
+  const auto begin = bench_clock::now();
+  for (std::size_t i = 0; i < num_completions; ++i)
+    event_loop.complete(LIBUSB_TRANSFER_COMPLETED);
+  return {bench_clock::now() - begin, num_completions};
+}
+
+// Each round submits a fresh set of transfers and only times their completion with |status|
+template <typename Start, typename Stop>
+result run_final(libusb_transfer_status status, Start&& start, Stop&& stop)
+{
+  result r;
+  for (std::size_t round = 0; round < num_rounds; ++round) {
+    start();
+    const auto begin = bench_clock::now();
+    while (!event_loop.empty())
+      event_loop.complete(status);
+    r.elapsed += bench_clock::now() - begin;
+    r.completions += num_transfers;
+    stop();
+  }
+  return r;
+}
+
+result bench_completed(std::size_t iso_packets)
+{
+  std::size_t consumed = 0;
+  usb_transfer_controller controller(&count_bytes, &consumed);
+  const auto r = run_completed([&] {
+    controller.start(nullptr, make_settings(iso_packets));
+    event_loop.fill_iso_packets();
+  });
+  controller.stop();
+  return r;
+}
+
+result bench_completed_locked(std::size_t iso_packets)
+{
+  std::size_t consumed = 0;
+  locked_completion_path path([&consumed](std::span<std::uint8_t> data) { consumed += data.size(); });
+  const auto r = run_completed([&] {
+    path.start(make_settings(iso_packets));
+    event_loop.fill_iso_packets();
+  });
+  // Let the rest go, the transfers are freed along with |path|
+  while (!event_loop.empty())
+    event_loop.complete(LIBUSB_TRANSFER_CANCELLED);
+  return r;
+}
+
+// The consumer side of the buffer hand-off: releases the filled buffers from another thread.
+// Without a second core to run on it can't keep up, so most completions end up dropped.
+struct handoff_consumer
+{
+  usb_transfer_controller* controller = nullptr;
+  spsc_queue<std::uint8_t*> filled{num_transfers + num_spare_buffers};
+  std::atomic<bool> done = false;
+
+  static void on_data(void* ctx, std::span<std::uint8_t> data)
+  {
+    static_cast<handoff_consumer*>(ctx)->filled.try_push(data.data());
+  }
+
+  void run()
+  {
+    std::uint8_t* buffer;
+    while (!done.load(std::memory_order_relaxed)) {
+      while (filled.try_pop(buffer))
+        controller->release_buffer(buffer);
+    }
+  }
+};
+
+result bench_handoff(std::uint64_t& dropped)
+{
+  handoff_consumer consumer;
+  usb_transfer_controller controller(&handoff_consumer::on_data, &consumer);
+  consumer.controller = &controller;
+  auto settings = make_settings(0);
+  settings.num_spare_buffers = num_spare_buffers;
+
+  std::thread consumer_thread;
+  const auto r = run_completed([&] {
+    controller.start(nullptr, settings);
+    consumer_thread = std::thread(&handoff_consumer::run, &consumer);
+  });
+  consumer.done = true;
+  consumer_thread.join();
+  dropped = controller.num_dropped_transfers();
+  controller.stop();
+  return r;
+}
+
+result bench_final(libusb_transfer_status status)
+{
+  std::size_t consumed = 0;
+  // Errors aren't recovered from, so they take the same way out as the old code
+  usb_transfer_controller controller(&count_bytes, &consumed);
+  return run_final(
+      status, [&] { controller.start(nullptr, make_settings(0, 0)); }, [&] { controller.stop(); });
+}
+
+result bench_final_locked(libusb_transfer_status status)
+{
+  std::size_t consumed = 0;
+  std::unique_ptr<locked_completion_path> path;
+  return run_final(
+      status,
+      [&] {
+        path = std::make_unique<locked_completion_path>(
+            [&consumed](std::span<std::uint8_t> data) { consumed += data.size(); });
+        path->start(make_settings(0));
+      },
+      [&] { path.reset(); });
+}
+
+} // namespace
+
+int main()
+{
+  std::printf("%-24s %13s %17s\n", "per completion", "lock-free", "mutex + find_if");
+
+  auto lock_free = bench_completed(0);
+  auto locked = bench_completed_locked(0);
+  report("bulk, completed", lock_free, &locked);
+
+  std::uint64_t dropped = 0;
+  lock_free = bench_handoff(dropped);
+  report("bulk, buffer hand-off", lock_free, nullptr);
+  std::printf("  (%llu of %zu dropped)\n", static_cast<unsigned long long>(dropped), num_completions);
+
+  lock_free = bench_completed(num_iso_packets);
+  locked = bench_completed_locked(num_iso_packets);
+  report("isochronous, completed", lock_free, &locked);
+
+  lock_free = bench_final(LIBUSB_TRANSFER_CANCELLED);
+  locked = bench_final_locked(LIBUSB_TRANSFER_CANCELLED);
+  report("bulk, cancelled", lock_free, &locked);
+
+  lock_free = bench_final(LIBUSB_TRANSFER_ERROR);
+  locked = bench_final_locked(LIBUSB_TRANSFER_ERROR);
+  report("bulk, error", lock_free, &locked);
+  return 0;
+}
@@ -0,0 +1,124 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/thread.hpp"
+
+#include <libusb.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Aggregate throughput of independent libusb event loops, i.e. the shards of a usb_context with num_event_loops > 1.
+// There are no devices to complete transfers, so each event thread wakes its own loop with
+// libusb_interrupt_event_handler() and then does a transfer's worth of synthetic work, like a completion handler
+// would. The loops never run dry, so this shows how far event handling plus per-completion work scales with the
+// number of shards (and cores).
+
+using namespace pseye;
+using bench_clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr std::size_t max_event_loops = 8;
+constexpr std::size_t transfer_size = 65536;
+constexpr auto run_time = std::chrono::seconds(1);
+
+struct alignas(64) shard
+{
+  libusb_context* context = nullptr;
+  std::vector<std::uint8_t> buffer;
+  std::uint64_t num_wakeups = 0;
+  std::uint64_t checksum = 0;
+};
+
+// Same setup as usb_context::run_event_loop()
+void run_event_loop(shard& s, std::size_t index, const std::atomic<bool>& stop_requested)
+{
+  thread_options thread{.name = "pseye-usb-" + std::to_string(index)};
+  if (const auto num_cpus = std::thread::hardware_concurrency(); num_cpus > 1)
+    thread.cpu_affinity = {static_cast<unsigned>(index % num_cpus)};
+  configure_current_thread(thread);
+
+  timeval tv;
+  tv.tv_sec = 0;
+  tv.tv_usec = 25 * 1000;
+  while (!stop_requested.load(std::memory_order_relaxed)) {
+    ::libusb_interrupt_event_handler(s.context);
+    ::libusb_handle_events_timeout_completed(s.context, &tv, NULL);
+
+    // Stand-in for the data handler: look at every byte of the transfer
+    std::uint64_t sum = 0;
+    for (const auto value : s.buffer)
+      sum += value;
+    s.checksum += sum;
+    ++s.num_wakeups;
+  }
+}
+
+} // namespace
+
+int main()
+{
+  const libusb_init_option options[] = {
+      {LIBUSB_OPTION_NO_DEVICE_DISCOVERY, {0}},
+  };
+
+  std::printf("%-12s %14s %14s %8s\n", "event loops", "wakeups/s", "MiB/s", "speedup");
+  double single_loop_rate = 0.0;
+  for (std::size_t num_event_loops = 1; num_event_loops <= max_event_loops; num_event_loops *= 2) {
+    std::vector<shard> shards(num_event_loops);
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+      const auto ret = ::libusb_init_context(&shards[i].context, options, static_cast<int>(std::size(options)));
+      if (ret != LIBUSB_SUCCESS) {
+        std::fprintf(stderr, "failed to init libusb context: %d %s\n", ret, ::libusb_error_name(ret));
+        return EXIT_FAILURE;
+      }
+      shards[i].buffer.resize(transfer_size);
+      for (std::size_t j = 0; j < transfer_size; ++j)
+        shards[i].buffer[j] = static_cast<std::uint8_t>(i + j);
+    }
+
+    std::atomic<bool> stop_requested = false;
+    std::vector<std::thread> threads;
+    const auto start = bench_clock::now();
+    for (std::size_t i = 0; i < shards.size(); ++i)
+      threads.emplace_back(&run_event_loop, std::ref(shards[i]), i, std::cref(stop_requested));
+    std::this_thread::sleep_for(run_time);
+    stop_requested = true;
+    for (auto& thread : threads)
+      thread.join();
+    const auto seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    std::uint64_t num_wakeups = 0;
+    for (const auto& s : shards) {
+      num_wakeups += s.num_wakeups;
+      ::libusb_exit(s.context);
+    }
+
+    const auto rate = static_cast<double>(num_wakeups) / seconds;
+    if (num_event_loops == 1)
+      single_loop_rate = rate;
+    std::printf("%-12zu %14.0f %14.1f %7.2fx\n", num_event_loops, rate,
+                rate * static_cast<double>(transfer_size) / (1024.0 * 1024.0), rate / single_loop_rate);
+  }
+  std::printf("(%u hardware threads)\n", std::thread::hardware_concurrency());
+  return 0;
+}
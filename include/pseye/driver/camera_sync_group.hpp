@@ -0,0 +1,107 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_CAMERASYNCGROUP_HPP
+#define PSEYE_DRIVER_CAMERASYNCGROUP_HPP
+
+#include "pseye/detail/config.hpp"
+#include "pseye/driver/spsc_frame_buffer.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+class simple_pseye_camera;
+
+struct camera_sync_options
+{
+  // Maximum spread of the (estimated) capture times within a bundle
+  std::chrono::microseconds tolerance{2000};
+  // Deliver frames that can't be matched anymore as incomplete bundles instead of dropping them
+  bool deliver_unmatched = false;
+};
+
+struct synced_frame
+{
+  // Empty if the camera has no frame in this bundle
+  std::span<const std::uint8_t> data;
+  frame_metadata metadata;
+  // see frame_metadata::capture_time
+  std::chrono::steady_clock::time_point capture_time;
+};
+
+struct frame_bundle
+{
+  // One entry per camera, in the order they were added
+  std::vector<synced_frame> frames;
+  // False if only unmatched frames are included
+  bool complete = false;
+};
+
+/// Groups the frames of several cameras by capture time.
+/// The group is the only reader of its cameras' frame buffers, bundles reference their frames without copying.
+class camera_sync_group
+{
+public:
+  explicit camera_sync_group(const camera_sync_options& options = {});
+
+  camera_sync_group(const camera_sync_group&) = delete;
+  camera_sync_group& operator=(const camera_sync_group&) = delete;
+
+  // |camera| must be streaming (and keep its frame size) while it's part of the group.
+  // Zero-copy cameras aren't supported, they're rejected with std::invalid_argument.
+  void add_camera(simple_pseye_camera& camera);
+
+  // Waits for the next bundle, whose frames stay valid until release() or the next call
+  bool wait_until(std::chrono::steady_clock::time_point deadline, frame_bundle& bundle);
+  template <class Rep, class Period>
+  bool wait_for(const std::chrono::duration<Rep, Period>& rel_time, frame_bundle& bundle)
+  {
+    return wait_until(std::chrono::steady_clock::now() + rel_time, bundle);
+  }
+  // Hands the frames of the last bundle back to their cameras
+  void release();
+
+  // Frames dropped because they couldn't be matched
+  std::uint64_t num_dropped_frames() const { return num_dropped_frames_; }
+
+private:
+  struct member
+  {
+    spsc_frame_buffer* frame_buffer = nullptr;
+    // Oldest frame not yet delivered or dropped
+    std::span<const std::uint8_t> frame;
+    frame_metadata metadata;
+    std::chrono::steady_clock::time_point capture_time;
+    bool in_bundle = false;
+  };
+
+  bool fetch(member& m, std::chrono::steady_clock::time_point deadline);
+  void discard(member& m);
+
+  camera_sync_options options_;
+  std::vector<member> members_;
+  std::uint64_t num_dropped_frames_ = 0;
+};
+
+PSEYE_NS_END
+
+#endif
@@ -0,0 +1,119 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_CAMERATRANSPORT_HPP
+#define PSEYE_DRIVER_CAMERATRANSPORT_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "pseye/driver/pseye_device_state.hpp"
+#include "pseye/driver/usb_transfer_controller.hpp"
+#include "pseye/hw/ov534.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <span>
+
+PSEYE_NS_BEGIN
+
+/// USB-level streaming options for simple_pseye_camera::start()
+struct usb_stream_options
+{
+  // Isochronous mode requires a device exposing an isochronous endpoint, but reserves its bus bandwidth
+  ov534::transfer transfer_mode = ov534::transfer::bulk;
+  // Number of packets per isochronous transfer (one UVC payload each)
+  std::size_t iso_packets_per_transfer = 32;
+  // Transfer buffer memory, see buffer_allocation() for what we actually got
+  usb_buffer_allocation buffer_allocation = usb_buffer_allocation::heap;
+  // Bulk mode only: adapt transfer depth & length to the stream, frame and payload sizes are filled in by start()
+  usb_transfer_tuning tuning;
+  // Bulk mode only: parse transfers on a per-camera worker thread instead of the libusb event thread,
+  // resubmitting transfers right away with one of |spare_buffers|
+  bool pipelined = false;
+  std::size_t spare_buffers = 8;
+  // Pipelined mode only: assemble frames into simple_pseye_camera::segmented_frames() without copying the payload
+  // data. Pending frames keep their transfers' buffers, so |spare_buffers| should cover a couple of frames.
+  bool zero_copy = false;
+  // Deliver frames damaged by transfer errors instead of dropping them, frame_metadata tells which rows to distrust
+  bool salvage_frames = false;
+  // see usb_transfer_settings::max_recovery_attempts
+  std::size_t max_recovery_attempts = 3;
+  // Power the sensor down and park the transfers once no frame was read for this long (0 never does),
+  // the next read wakes it up again
+  std::chrono::milliseconds idle_timeout{0};
+};
+
+/// Shape of the data stream a transport delivers after camera_transport::configure()
+struct camera_stream_layout
+{
+  // UVC payload size (including the header)
+  std::uint32_t payload_size = 0;
+  // Data passed to the handler is owned by the receiver until it calls camera_transport::release_buffer()
+  bool buffer_handoff = false;
+  // Buffer hand-off only: maximum number of buffers the receiver might own at once
+  std::size_t max_handoff_buffers = 0;
+  // Ticks per second of the device clock used for PTS & SCR (assumed to be the OV534's 48 MHz system clock)
+  std::uint32_t clock_frequency = 48'000'000;
+};
+
+/// Source of UVC-framed payload data for simple_pseye_camera.
+/// NOTE: the data handler is called from a transport-owned thread (e.g. the libusb event thread).
+class camera_transport
+{
+public:
+  using data_handler = void (*)(void* ctx, std::span<std::uint8_t> data);
+  using recovery_handler = usb_transfer_controller::recovery_handler;
+
+  virtual ~camera_transport() = default;
+
+  // Must not be changed while streaming
+  void set_handler(data_handler handler, void* ctx)
+  {
+    handler_ = handler;
+    handler_ctx_ = ctx;
+  }
+
+  // Notified about in-place recovery of the stream, must not be changed while streaming
+  void set_recovery_handler(recovery_handler handler, void* ctx)
+  {
+    recovery_handler_ = handler;
+    recovery_handler_ctx_ = ctx;
+  }
+
+  // Programs the device for |state| (adjusting it to what the device actually does), no data is delivered yet
+  virtual camera_stream_layout configure(pseye_device_state& state, const usb_stream_options& options) = 0;
+  // Starts delivering data to the handler
+  virtual void start() = 0;
+  // Stops streaming, the handler isn't called anymore once this returns
+  virtual void stop() = 0;
+  // Buffer hand-off only: give back a buffer passed to the handler, must be called from a single thread
+  virtual void release_buffer(std::uint8_t* buffer) = 0;
+  // Pauses a started stream as cheaply as possible, resume() continues with the configuration intact
+  virtual void suspend() { stop(); }
+  virtual void resume() { start(); }
+
+protected:
+  data_handler handler_ = nullptr;
+  void* handler_ctx_ = nullptr;
+  recovery_handler recovery_handler_ = nullptr;
+  void* recovery_handler_ctx_ = nullptr;
+};
+
+PSEYE_NS_END
+
+#endif
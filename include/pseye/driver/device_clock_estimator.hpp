@@ -0,0 +1,84 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_DEVICECLOCKESTIMATOR_HPP
+#define PSEYE_DRIVER_DEVICECLOCKESTIMATOR_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+/// Maps 32-bit device clock timestamps (PTS/SCR) to host time.
+/// Host timestamps can only be late (by the transfer latency), never early, so both drift and offset come from the lower
+/// envelope of the observations: the drift is fitted over the least delayed observation of each block of |window|
+/// observations (covering |num_blocks| blocks), the offset is taken from the last |window| observations.
+class device_clock_estimator
+{
+public:
+  explicit device_clock_estimator(std::uint32_t frequency = 48'000'000,
+                                  std::size_t window = 64,
+                                  std::size_t num_blocks = 16);
+
+  void reset();
+  // |device_time| was observed at |host_time|; observations must be roughly in order, wrap-arounds are handled
+  void add(std::uint32_t device_time, std::chrono::steady_clock::time_point host_time);
+
+  bool is_valid() const { return num_samples_ != 0; }
+  std::chrono::steady_clock::time_point to_host(std::uint32_t device_time) const;
+  // Device clock speed relative to ours, in parts per million (positive: device runs fast)
+  double drift_ppm() const { return (1.0 / slope_ - 1.0) * 1e6; }
+
+private:
+  struct sample
+  {
+    double device_seconds;
+    double host_seconds;
+  };
+
+  std::int64_t unwrap(std::uint32_t device_time) const;
+  void fit_drift();
+  void fit_offset();
+
+  double frequency_;
+  std::vector<sample> samples_;
+  std::size_t num_samples_ = 0;
+  std::size_t next_sample_ = 0;
+
+  std::vector<sample> block_minima_;
+  std::size_t num_blocks_ = 0;
+  std::size_t next_block_ = 0;
+  sample block_min_{};
+  std::size_t block_fill_ = 0;
+
+  // All times are relative to the first observation
+  std::chrono::steady_clock::time_point host_base_;
+  std::uint32_t last_device_time_ = 0;
+  std::int64_t last_unwrapped_ = 0;
+
+  // host_seconds = offset_ + slope_ * device_seconds
+  double slope_ = 1.0;
+  double offset_ = 0.0;
+};
+
+PSEYE_NS_END
+
+#endif
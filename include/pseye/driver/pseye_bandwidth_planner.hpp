@@ -0,0 +1,81 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_PSEYEBANDWIDTHPLANNER_HPP
+#define PSEYE_DRIVER_PSEYEBANDWIDTHPLANNER_HPP
+
+#include "pseye/detail/config.hpp"
+#include "pseye/driver/pseye_device_state.hpp"
+#include "pseye/pixel_format.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+/// A stream configuration as passed to simple_pseye_camera::start()
+struct pseye_stream_config
+{
+  size_mode mode = size_mode::vga;
+  int frame_rate = 75;
+  pixel_format internal_format = pixel_format::grbg8;
+};
+
+struct pseye_bandwidth_request
+{
+  // Cameras on the same bus share its bandwidth
+  std::uint8_t bus_number = 0;
+  pseye_stream_config config;
+};
+
+struct pseye_bandwidth_limits
+{
+  // What a high-speed bus reliably sustains for bulk video in practice, well below the theoretical 60 MB/s
+  std::uint64_t bytes_per_second_per_bus = 40'000'000;
+  // Never plan below this frame rate, cameras that don't fit even then are reported as infeasible
+  int min_frame_rate = 15;
+};
+
+struct pseye_bandwidth_plan_entry
+{
+  // Best configuration that fits, the request itself if it did
+  pseye_stream_config config;
+  std::uint64_t bytes_per_second = 0;
+  bool degraded = false;
+};
+
+struct pseye_bandwidth_plan
+{
+  // Same order as the requests
+  std::vector<pseye_bandwidth_plan_entry> cameras;
+  // False if some bus is oversubscribed even with every camera at its lowest configuration
+  bool feasible = true;
+};
+
+// Bus bandwidth needed to stream |config|, including the UVC payload headers
+std::uint64_t stream_bandwidth(const pseye_stream_config& config);
+
+// Fits all |requests| into the bandwidth of their buses. Cameras on an oversubscribed bus are degraded one step at a
+// time (most expensive first), trading color for raw Bayer data, then VGA for QVGA and finally frame rate.
+pseye_bandwidth_plan plan_bandwidth(std::span<const pseye_bandwidth_request> requests,
+                                    const pseye_bandwidth_limits& limits = {});
+
+PSEYE_NS_END
+
+#endif
@@ -0,0 +1,80 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_PSEYECAMERASTARTUP_HPP
+#define PSEYE_DRIVER_PSEYECAMERASTARTUP_HPP
+
+#include "pseye/detail/config.hpp"
+#include "pseye/driver/pseye_enumerator.hpp"
+#include "pseye/driver/simple_pseye_camera.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include <exception>
+#include <memory>
+#include <span>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+class pseye_topology_cache;
+
+/// One camera to bring up with start_pseye_cameras()
+struct pseye_camera_request
+{
+  pseye_device_info device;
+  pseye_device_state initial_state;
+  size_mode mode = size_mode::vga;
+  int frame_rate = 75;
+  pixel_format internal_format = pixel_format::grbg8;
+  usb_stream_options options;
+};
+
+enum class pseye_startup_stage
+{
+  opening,
+  initializing,
+  starting,
+  streaming,
+  failed,
+};
+
+struct pseye_camera_startup
+{
+  // Set once the camera is streaming
+  std::unique_ptr<simple_pseye_camera> camera;
+  // Set if any stage failed
+  std::exception_ptr error;
+};
+
+// Called from the startup threads (concurrently for different cameras) whenever camera |index| enters |stage|
+using pseye_startup_progress_handler = void (*)(void* ctx, std::size_t index, pseye_startup_stage stage);
+
+// Opens, initializes and starts all requested cameras concurrently, so bringing up a rig takes about as long as
+// bringing up its slowest camera. Failures don't affect the other cameras, they're reported per camera.
+std::vector<pseye_camera_startup> start_pseye_cameras(usb_context& context,
+                                                      std::span<const pseye_camera_request> requests,
+                                                      pseye_startup_progress_handler progress = nullptr,
+                                                      void* progress_ctx = nullptr);
+// Same, but opens the cameras through |topology| without scanning the bus
+std::vector<pseye_camera_startup> start_pseye_cameras(pseye_topology_cache& topology,
+                                                      std::span<const pseye_camera_request> requests,
+                                                      pseye_startup_progress_handler progress = nullptr,
+                                                      void* progress_ctx = nullptr);
+
+PSEYE_NS_END
+
+#endif
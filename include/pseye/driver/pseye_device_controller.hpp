@@ -36,15 +36,35 @@ inline constexpr std::uint8_t pseye_interface_number = 0;
 inline constexpr std::uint32_t vga_frame_rates[] = {75, 60, 50, 40, 30, 15};
 inline constexpr std::uint32_t qvga_frame_rates[] = {187, 150, 137, 125, 100, 75, 60, 50, 37, 30};
 
+/// Streaming endpoints of an interface, as found in the active config descriptor
+struct pseye_endpoints
+{
+  std::uint8_t bulk = 0;
+  // 0 if the device doesn't offer one
+  std::uint8_t iso = 0;
+  std::uint8_t iso_alternate_setting = 0;
+};
+
+// Doesn't need the device to be opened, throws usb_error if there's no bulk endpoint
+pseye_endpoints find_pseye_endpoints(libusb_device* device, std::uint8_t interface_index);
+
 /// Low-level control over the PlayStation Eye camera device.
 class pseye_device_controller
 {
 public:
   pseye_device_controller(libusb_device* device, std::uint8_t interface_index);
   pseye_device_controller(libusb_device_handle* device, std::uint8_t interface_index);
+  // Skips reading the config descriptor if the endpoints are already known
+  pseye_device_controller(libusb_device_handle* device,
+                          std::uint8_t interface_index,
+                          const pseye_endpoints& endpoints);
 
   libusb_device_handle* get() const { return device_handle_.get(); }
   std::uint8_t bulk_endpoint() const { return bulk_endpoint_; }
+  // 0 if the device doesn't offer one
+  std::uint8_t iso_endpoint() const { return iso_endpoint_; }
+  std::uint8_t iso_alternate_setting() const { return iso_alternate_setting_; }
+  std::uint8_t interface_index() const { return interface_index_; }
 
 private:
   struct free_device
@@ -55,6 +75,8 @@ private:
   std::unique_ptr<libusb_device_handle, free_device> device_handle_;
   std::uint8_t interface_index_;
   std::uint8_t bulk_endpoint_;
+  std::uint8_t iso_endpoint_ = 0;
+  std::uint8_t iso_alternate_setting_ = 0;
 };
 
 PSEYE_NS_END
@@ -55,6 +55,9 @@ void write_sccb_register(pseye_device_controller& controller,
     write_sccb_register(controller, sequence[i].reg, sequence[i].value);
 }
 
+// Points the SCCB master at our OV772x and reads its product ID & version (e.g. 0x7721)
+std::uint16_t read_sensor_id(pseye_device_controller& controller);
+
 // Write to indirect video data registers (own address space)
 void write_video_data(pseye_device_controller& controller, const void* data, int len, std::uint8_t offset = 0);
 
@@ -25,6 +25,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 PSEYE_NS_BEGIN
 
@@ -63,6 +64,8 @@ struct pseye_device_state
 };
 
 int find_valid_frame_rate(size_mode mode, int desired_fps);
+// All frame rates |mode| supports, fastest first
+std::vector<int> supported_frame_rates(size_mode mode);
 void set_frame_rate(pseye_device_controller& controller, size_mode mode, int desired_fps);
 void set_camera_led_status(pseye_device_controller& controller, bool on);
 void set_automatic_gain(pseye_device_controller& controller, bool val);
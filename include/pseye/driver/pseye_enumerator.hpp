@@ -0,0 +1,78 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_PSEYEENUMERATOR_HPP
+#define PSEYE_DRIVER_PSEYEENUMERATOR_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+typedef struct libusb_device libusb_device;
+typedef struct libusb_device_handle libusb_device_handle;
+
+PSEYE_NS_BEGIN
+
+class usb_context;
+
+/// A connected PlayStation Eye.
+/// Bus number and port path identify the physical port it's plugged into, which stays the same across reboots and
+/// re-plugging (unlike the device address).
+struct pseye_device_info
+{
+  std::uint8_t bus_number = 0;
+  std::uint8_t device_address = 0;
+  // Hub port numbers, starting at the root hub
+  std::vector<std::uint8_t> port_path;
+  // OV772x product ID & version (e.g. 0x7721), 0 if it wasn't queried or the camera is in use
+  std::uint16_t sensor_id = 0;
+
+  // "<bus>-<port>.<port>...", just like Linux names USB devices in sysfs
+  std::string location() const;
+};
+
+// Inverse of pseye_device_info::location()
+bool parse_device_location(std::string_view location, std::uint8_t& bus_number, std::vector<std::uint8_t>& port_path);
+
+// Describes |device| without querying its sensor
+pseye_device_info get_device_info(libusb_device* device);
+
+// Briefly claims |device| to read its sensor ID, 0 if that fails (e.g. because it's in use).
+// Cameras bound to a kernel driver are skipped rather than detached.
+std::uint16_t query_pseye_sensor_id(libusb_device* device);
+
+// Lists all connected cameras ordered by bus & port path. |query_sensor| briefly claims each camera to read its sensor ID.
+// With a topology cache set on |context|, that's its snapshot and the cache decides whether sensor IDs are queried.
+std::vector<pseye_device_info> enumerate_pseye_devices(usb_context& context, bool query_sensor = false);
+
+// Opens the camera plugged into the given port (through the context's topology cache, if any), nullptr if there is none
+libusb_device_handle* open_pseye_device(usb_context& context,
+                                        std::uint8_t bus_number,
+                                        std::span<const std::uint8_t> port_path);
+inline libusb_device_handle* open_pseye_device(usb_context& context, const pseye_device_info& info)
+{
+  return open_pseye_device(context, info.bus_number, info.port_path);
+}
+
+PSEYE_NS_END
+
+#endif
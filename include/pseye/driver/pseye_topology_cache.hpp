@@ -0,0 +1,93 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_PSEYETOPOLOGYCACHE_HPP
+#define PSEYE_DRIVER_PSEYETOPOLOGYCACHE_HPP
+
+#include "pseye/detail/config.hpp"
+#include "pseye/driver/pseye_device_controller.hpp"
+#include "pseye/driver/pseye_enumerator.hpp"
+#include "pseye/driver/usb_context.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include <atomic>
+#include <mutex>
+#include <span>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+struct pseye_topology_entry
+{
+  pseye_device_info info;
+  pseye_endpoints endpoints;
+};
+
+/// Snapshot of the connected cameras (port paths, endpoints, sensor IDs) that is only rescanned after hotplug events.
+/// Opening a camera through the cache doesn't touch the rest of the bus.
+/// Without hotplug support (Windows), a camera that isn't found triggers a rescan instead.
+class pseye_topology_cache
+{
+public:
+  // |context| must outlive the cache. |query_sensor| briefly claims each new camera (unless a kernel driver is bound
+  // to it) to read its sensor ID, which disturbs other users of the camera.
+  explicit pseye_topology_cache(usb_context& context, bool query_sensor = false);
+  ~pseye_topology_cache();
+
+  pseye_topology_cache(const pseye_topology_cache&) = delete;
+  pseye_topology_cache& operator=(const pseye_topology_cache&) = delete;
+
+  // Ordered by bus & port path, just like enumerate_pseye_devices()
+  std::vector<pseye_topology_entry> snapshot();
+  bool find(std::uint8_t bus_number, std::span<const std::uint8_t> port_path, pseye_topology_entry& entry);
+
+  // Opens the camera plugged into the given port (on the event loop assigned to its bus), nullptr if there is none.
+  // Pass the returned endpoints on to skip reading the config descriptor again.
+  libusb_device_handle* open(std::uint8_t bus_number,
+                             std::span<const std::uint8_t> port_path,
+                             pseye_endpoints* endpoints = nullptr);
+
+  // Rescans the bus right away
+  void refresh();
+
+  usb_context& context() { return context_; }
+
+private:
+  struct cached_device
+  {
+    pseye_topology_entry entry;
+    // Referenced libusb_device of each event loop (they're per libusb_context)
+    std::vector<libusb_device*> devices;
+  };
+
+  static void on_hotplug(void* ctx, usb_hotplug_event event, libusb_device* device);
+  void refresh_locked();
+  cached_device* find_locked(std::uint8_t bus_number, std::span<const std::uint8_t> port_path);
+  static void release(std::vector<cached_device>& devices);
+
+  usb_context& context_;
+  bool query_sensor_;
+  int hotplug_id_ = 0;
+  std::atomic<bool> stale_ = true;
+
+  std::mutex mutex_;
+  std::vector<cached_device> devices_;
+};
+
+PSEYE_NS_END
+
+#endif
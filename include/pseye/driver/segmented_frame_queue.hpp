@@ -0,0 +1,150 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_SEGMENTEDFRAMEQUEUE_HPP
+#define PSEYE_DRIVER_SEGMENTEDFRAMEQUEUE_HPP
+
+#include "pseye/detail/config.hpp"
+#include "pseye/driver/spsc_frame_buffer.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+/// Reference to a transfer buffer held by a pinned_buffer_pool
+struct buffer_pin
+{
+  std::uint32_t slot = 0;
+  std::uint32_t generation = 0;
+};
+
+/// Reference-counted transfer buffers handed over by a camera_transport, given back once nobody needs them anymore.
+/// Thread-safe; references from before the last reset() or detach() are ignored.
+class pinned_buffer_pool
+{
+public:
+  using release_handler = void (*)(void* ctx, std::uint8_t* buffer);
+
+  // |capacity| must cover all buffers the transport might hand over at once
+  void reset(std::size_t capacity, release_handler handler, void* ctx);
+  // Forgets all pins without releasing anything, e.g. because the transport stopped
+  void detach();
+
+  // Takes over |buffer| with a single reference.
+  // False if all slots are in use, |buffer| is then given back right away and must not be used anymore.
+  bool pin(std::uint8_t* buffer, buffer_pin& pin);
+  void ref(const buffer_pin& pin);
+  // Gives the buffer back to the transport with its last reference
+  void unref(const buffer_pin& pin);
+
+private:
+  struct slot
+  {
+    std::uint8_t* buffer = nullptr;
+    std::uint32_t refs = 0;
+  };
+
+  std::mutex mutex_;
+  std::vector<slot> slots_;
+  std::uint32_t generation_ = 0;
+  release_handler handler_ = nullptr;
+  void* handler_ctx_ = nullptr;
+};
+
+/// A frame assembled without copying, its payload data stays in the transfer buffers it arrived in
+struct segmented_frame
+{
+  // Payload data in order, |size| bytes in total
+  std::vector<std::span<const std::uint8_t>> segments;
+  std::size_t size = 0;
+  frame_metadata metadata;
+  // Transfer buffers |segments| point into
+  std::vector<buffer_pin> pins;
+
+  // For consumers needing the frame in one piece, |out| must hold at least |size| bytes
+  void copy_to(std::span<std::uint8_t> out) const;
+};
+
+/// spsc_frame_buffer for segmented frames: finished frames keep their transfer buffers pinned until they're read.
+/// If the consumer falls behind, new frames are dropped instead of overwriting the pending ones.
+class segmented_frame_queue
+{
+public:
+  segmented_frame_queue(std::uint32_t num_frames, pinned_buffer_pool& pool);
+
+  // Producer side
+  segmented_frame& writable_frame() { return frames_[head_]; }
+  // False if the queue is full, the frame then stays writable (still pinning its buffers)
+  bool finish_writing();
+  // Unpins and clears the writable frame
+  void discard_writable_frame();
+
+  // Consumer side, frames stay valid until finish_reading()
+  template <class Rep, class Period>
+  const segmented_frame* readable_frame_wait_for(const std::chrono::duration<Rep, Period>& rel_time)
+  {
+    notify_read();
+    std::unique_lock lock(mutex_);
+    if (new_frame_condition_.wait_for(lock, rel_time, [this]() { return used_ != 0; }))
+      return &frames_[tail_];
+    return nullptr;
+  }
+  void finish_reading();
+  // Drops all frames not yet read, neither side may be active
+  void clear();
+
+  // see spsc_frame_buffer::set_read_handler()
+  using read_handler = spsc_frame_buffer::read_handler;
+  void set_read_handler(read_handler handler, void* ctx)
+  {
+    read_handler_ = handler;
+    read_handler_ctx_ = ctx;
+  }
+
+private:
+  void notify_read()
+  {
+    if (read_handler_)
+      read_handler_(read_handler_ctx_);
+  }
+  void unpin(segmented_frame& frame);
+
+  pinned_buffer_pool& pool_;
+  std::unique_ptr<segmented_frame[]> frames_;
+  std::uint32_t num_frames_;
+
+  std::uint32_t head_ = 0;
+  std::uint32_t tail_ = 0;
+  std::uint32_t used_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable new_frame_condition_;
+
+  read_handler read_handler_ = nullptr;
+  void* read_handler_ctx_ = nullptr;
+};
+
+PSEYE_NS_END
+
+#endif
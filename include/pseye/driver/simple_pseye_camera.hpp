@@ -21,46 +21,180 @@
 #pragma once
 #endif
 
+#include "pseye/driver/camera_transport.hpp"
 #include "pseye/driver/pseye_device_controller.hpp"
 #include "pseye/driver/pseye_device_state.hpp"
-#include "pseye/driver/usb_transfer_controller.hpp"
-#include "pseye/driver/uvc_frame_processor.hpp"
+#include "pseye/driver/segmented_frame_queue.hpp"
+#include "pseye/driver/spsc_frame_buffer.hpp"
+#include "pseye/driver/spsc_queue.hpp"
+#include "pseye/driver/usb_context.hpp"
+#include "pseye/driver/uvc_frame_assembler.hpp"
 #include "pseye/pixel_format.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 PSEYE_NS_BEGIN
 
-class spsc_frame_buffer;
+class pseye_topology_cache;
+class usb_camera_transport;
+class usb_stream_recorder;
+
+/// What simple_pseye_camera does when its device disappears while streaming
+struct usb_reconnect_policy
+{
+  // Reopen attempts are made this often, hotplug events (where supported) trigger one right away
+  std::chrono::milliseconds retry_interval{500};
+  // Give up (and become inactive) after this long, 0 waits forever
+  std::chrono::milliseconds timeout{0};
+  // Reopen via this cache instead of scanning the bus, must belong to the same context and outlive the camera
+  pseye_topology_cache* topology = nullptr;
+  // Reopens the camera instead of looking for it on its port, nullptr if it isn't back yet.
+  // Lets transports other than usb_camera_transport reconnect, see enable_reconnect().
+  std::unique_ptr<camera_transport> (*reopen)(void* ctx) = nullptr;
+  void* reopen_ctx = nullptr;
+};
 
 class simple_pseye_camera
 {
 public:
   simple_pseye_camera(libusb_device* device, const pseye_device_state& initial_state);
   simple_pseye_camera(libusb_device_handle* device, const pseye_device_state& initial_state);
+  simple_pseye_camera(libusb_device_handle* device,
+                      const pseye_endpoints& endpoints,
+                      const pseye_device_state& initial_state);
+  simple_pseye_camera(std::unique_ptr<camera_transport> transport, const pseye_device_state& initial_state);
   ~simple_pseye_camera();
 
   simple_pseye_camera(const simple_pseye_camera&) = delete;
   simple_pseye_camera& operator=(const simple_pseye_camera&) = delete;
 
-  void start(size_mode mode, int frame_rate = 75, pixel_format internal_format = pixel_format::grbg8);
+  void start(size_mode mode,
+             int frame_rate = 75,
+             pixel_format internal_format = pixel_format::grbg8,
+             const usb_stream_options& options = {});
   void stop();
 
   const pseye_device_state& state() const { return state_; }
   spsc_frame_buffer& frame_buffer() { return *frame_buffer_; }
+  // Zero-copy mode only (usb_stream_options::zero_copy), replaces frame_buffer().
+  // All frames must be finished reading before the stream stops (or the device gets lost).
+  segmented_frame_queue& segmented_frames() { return *segmented_frames_; }
+  // Whether the stream actually ended up in zero-copy mode
+  bool is_zero_copy() const { return zero_copy_; }
+  // Ticks per second of the device clock the frame PTS are based on
+  std::uint32_t clock_frequency() const { return clock_frequency_; }
   bool is_active() const { return is_active_; }
+  camera_transport& transport() { return *transport_; }
+  // Only set if we're streaming from an actual device
+  usb_camera_transport* usb_transport() { return usb_transport_; }
+
+  // Reopens the camera plugged into the same port after it got lost (unplugged, hub brown-out) and resumes streaming
+  // with the current state. |context| must outlive the camera.
+  void enable_reconnect(usb_context& context, const usb_reconnect_policy& policy = {});
+  // Same for any transport, reopening only through |policy.reopen| (which is required) every |retry_interval|
+  void enable_reconnect(const usb_reconnect_policy& policy);
+  void disable_reconnect();
+
+  // Notified (on a transport thread) whenever the stream is recovered in place, must not be changed while streaming
+  void set_recovery_handler(camera_transport::recovery_handler handler, void* ctx)
+  {
+    recovery_handler_ = handler;
+    recovery_handler_ctx_ = ctx;
+  }
+
+  // Hands each block of |rows_per_slice| rows to |handler| as soon as it's received, on the thread assembling frames
+  // (see spsc_frame_buffer::set_slice_handler()). Copying mode only, must not be changed while streaming.
+  void set_slice_handler(std::size_t rows_per_slice, spsc_frame_buffer::slice_handler handler, void* ctx)
+  {
+    rows_per_slice_ = rows_per_slice;
+    slice_handler_ = handler;
+    slice_handler_ctx_ = ctx;
+  }
+
+  // Records all transfer data received while streaming, |recorder| must outlive the stream
+  void set_recorder(usb_stream_recorder* recorder) { recorder_ = recorder; }
 
 private:
-  void initialize();
-  void process_transfer_data(std::span<uint8_t> data);
+  void attach_transport(std::unique_ptr<camera_transport> transport);
+  void start_stream();
+  void stop_stream();
+  void on_transfer_data(std::span<uint8_t> data);
+  void on_recovery(const usb_recovery_info& info);
+  void on_hotplug(usb_hotplug_event event, libusb_device* device);
+  void on_frame_read();
+  void run_idle_monitor();
+  void stop_idle_monitor();
+  bool suspend_stream(std::chrono::steady_clock::rep last_read);
+  void resume_stream();
+  void start_reconnect(const usb_reconnect_policy& policy);
+  void run_reconnect();
+  void reconnect();
+  void process_transfer_data(std::chrono::steady_clock::time_point completion_time, std::span<uint8_t> data);
+  void run_parser();
+  void stop_parser();
 
-  pseye_device_controller handle_;
+  // Guards (re-)starting and stopping the stream
+  std::mutex stream_mutex_;
+  std::unique_ptr<camera_transport> transport_;
+  usb_camera_transport* usb_transport_ = nullptr;
   pseye_device_state state_;
-  usb_transfer_controller transfer_;
-  uvc_frame_processor processor_;
-  std::uint32_t payload_size_ = 0;
+  usb_stream_options options_;
+  std::uint32_t clock_frequency_ = 0;
+  uvc_frame_assembler assembler_;
   std::unique_ptr<spsc_frame_buffer> frame_buffer_;
-  bool is_active_ = false;
+  // Zero-copy mode: frames reference the transfer buffers pinned in |buffer_pool_|
+  bool zero_copy_ = false;
+  pinned_buffer_pool buffer_pool_;
+  std::unique_ptr<segmented_frame_queue> segmented_frames_;
+  usb_stream_recorder* recorder_ = nullptr;
+  camera_transport::recovery_handler recovery_handler_ = nullptr;
+  void* recovery_handler_ctx_ = nullptr;
+  std::size_t rows_per_slice_ = 0;
+  spsc_frame_buffer::slice_handler slice_handler_ = nullptr;
+  void* slice_handler_ctx_ = nullptr;
+  // Set once the transport recovered, the receiving thread then resyncs |assembler_|
+  std::atomic<bool> resync_requested_ = false;
+  std::atomic<bool> is_active_ = false;
+
+  // Reconnecting: signalled by the transport (device lost) and usb_context (device arrived)
+  usb_context* reconnect_context_ = nullptr;
+  usb_reconnect_policy reconnect_policy_;
+  std::uint8_t reconnect_bus_number_ = 0;
+  std::vector<std::uint8_t> reconnect_port_path_;
+  int hotplug_id_ = 0;
+  std::mutex signal_mutex_;
+  std::condition_variable signal_condition_;
+  bool device_lost_ = false;
+  bool device_arrived_ = false;
+  bool reconnect_exit_requested_ = false;
+  std::thread reconnect_thread_;
+
+  // Idle suspension: |idle_thread_| suspends the transport once the consumer stopped reading, the next read resumes it
+  std::atomic<std::chrono::steady_clock::rep> last_read_ = 0;
+  std::atomic<bool> suspended_ = false;
+  std::mutex idle_mutex_;
+  std::condition_variable idle_condition_;
+  bool resume_requested_ = false;
+  bool idle_exit_requested_ = false;
+  std::thread idle_thread_;
+
+  // Pipelined mode: transfers handed over by |transport_| on their way to |parser_thread_|
+  struct pending_transfer
+  {
+    std::chrono::steady_clock::time_point completion_time;
+    std::span<std::uint8_t> data;
+  };
+  bool pipelined_ = false;
+  spsc_queue<pending_transfer> pending_transfers_;
+  std::atomic<std::uint32_t> pending_signal_ = 0;
+  std::atomic<bool> parser_exit_requested_ = false;
+  std::thread parser_thread_;
 };
 
 PSEYE_NS_END
@@ -0,0 +1,102 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_SIMULATEDCAMERATRANSPORT_HPP
+#define PSEYE_DRIVER_SIMULATEDCAMERATRANSPORT_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "pseye/driver/camera_transport.hpp"
+#include "pseye/driver/spsc_queue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+enum class simulated_pattern
+{
+  color_bars,
+  gradient,
+  checkerboard,
+};
+
+/// Behaviour of the simulated camera, the stream layout follows the OV534 (see usb_camera_transport)
+struct simulator_settings
+{
+  simulated_pattern pattern = simulated_pattern::color_bars;
+  // Frames per second, 0 uses the rate passed to simple_pseye_camera::start()
+  double frame_rate = 0.0;
+  // Pace frames like the device would, otherwise deliver them as fast as the receiver takes them
+  bool real_time = true;
+  // Bulk mode only: payloads are packed into transfers of up to this many bytes, a frame's last one is short
+  std::size_t transfer_size = 0x10000;
+
+  // Error injection: probabilities per payload (ERR bit set, PTS missing) or per frame (frame cut short)
+  double error_bit_probability = 0.0;
+  double missing_pts_probability = 0.0;
+  double truncated_frame_probability = 0.0;
+  std::uint32_t seed = 0;
+};
+
+/// Generates UVC-framed payloads just like an OV534 would, without any hardware.
+/// NOTE: the data handler is called from a simulator-owned thread.
+class simulated_camera_transport final : public camera_transport
+{
+public:
+  // Frequency of the simulated device clock used for PTS & SCR
+  static constexpr std::uint32_t clock_frequency = 48'000'000;
+
+  explicit simulated_camera_transport(const simulator_settings& settings = {});
+  ~simulated_camera_transport() override;
+
+  camera_stream_layout configure(pseye_device_state& state, const usb_stream_options& options) override;
+  void start() override;
+  void stop() override;
+  void release_buffer(std::uint8_t* buffer) override { free_buffers_.try_push(buffer); }
+
+  std::uint64_t num_frames() const { return num_frames_.load(std::memory_order_relaxed); }
+  // Buffer hand-off only: transfers dropped because the receiver didn't give back any buffer in time
+  std::uint64_t num_dropped_transfers() const { return num_dropped_transfers_.load(std::memory_order_relaxed); }
+
+private:
+  void render_frame(const pseye_device_state& state);
+  void run();
+
+  simulator_settings settings_;
+  std::vector<std::uint8_t> frame_;
+  double frame_rate_ = 0.0;
+  std::uint32_t payload_size_ = 0;
+  std::size_t transfer_size_ = 0;
+
+  // Transfer buffers; with hand-off, the ones not owned by the receiver are kept in |free_buffers_|
+  std::vector<std::uint8_t> buffers_;
+  bool handoff_enabled_ = false;
+  spsc_queue<std::uint8_t*> free_buffers_;
+
+  std::thread thread_;
+  std::atomic<bool> stop_requested_ = false;
+  std::atomic<std::uint64_t> num_frames_ = 0;
+  std::atomic<std::uint64_t> num_dropped_transfers_ = 0;
+};
+
+PSEYE_NS_END
+
+#endif
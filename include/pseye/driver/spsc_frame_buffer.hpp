@@ -21,27 +21,97 @@
 #pragma once
 #endif
 
+#include <bitset>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 #include <span>
 
 PSEYE_NS_BEGIN
 
+// Why a salvaged frame is incomplete (see usb_stream_options::salvage_frames)
+inline constexpr std::uint8_t frame_error_payload = 1 << 0;     // ERR bit set or unreadable payload header
+inline constexpr std::uint8_t frame_error_missing_pts = 1 << 1; // payload without PTS
+inline constexpr std::uint8_t frame_error_overflow = 1 << 2;    // more data than fits, the excess got dropped
+inline constexpr std::uint8_t frame_error_short = 1 << 3;       // EOF came early, the remaining rows are missing
+
+// Rows of the largest frame we stream (VGA)
+inline constexpr std::size_t max_frame_rows = 480;
+
+/// Capture information of an assembled frame
+struct frame_metadata
+{
+  // Presentation time stamp (device clock) shared by all payloads of the frame
+  std::uint32_t pts = 0;
+  // When the transfer completing the frame was received
+  std::chrono::steady_clock::time_point completion_time;
+  // Counts all frames completed since start, including overwritten ones
+  std::uint64_t sequence = 0;
+  // Source clock reference (device clock) & USB frame number of the last payload carrying one, 0 if none did
+  std::uint32_t scr = 0;
+  std::uint16_t sof = 0;
+  // When the transfer carrying the frame's first payload was received
+  std::chrono::steady_clock::time_point first_payload_time;
+  // |pts| in host time, as estimated by correlating the device clock with our own (unset until the first estimate)
+  std::chrono::steady_clock::time_point capture_time;
+  // Salvage mode only: frame_error_* flags, 0 if the frame is intact
+  std::uint8_t errors = 0;
+  // Salvage mode only: rows with missing or suspect data
+  std::bitset<max_frame_rows> damaged_rows;
+};
+
+/// Rows of a frame that's still being received.
+/// The frame might still get dropped (e.g. over a transfer error), only its completion confirms the rows.
+struct frame_slice
+{
+  // Only valid while the slice handler runs
+  std::span<const std::uint8_t> data;
+  // A slice starting at row 0 begins a new frame, abandoning any unfinished one
+  std::size_t first_row = 0;
+  std::size_t num_rows = 0;
+  // frame_metadata::sequence the frame gets once it's complete
+  std::uint64_t sequence = 0;
+};
+
 class spsc_frame_buffer
 {
 public:
   spsc_frame_buffer(std::uint32_t num_frames, std::size_t frame_size);
   ~spsc_frame_buffer() = default;
 
+  std::size_t frame_size() const { return frame_size_; }
+
+  // Called on the consumer thread whenever it asks for a frame (before waiting for one)
+  using read_handler = void (*)(void* ctx);
+  void set_read_handler(read_handler handler, void* ctx)
+  {
+    read_handler_ = handler;
+    read_handler_ctx_ = ctx;
+  }
+
+  // Sub-frame notifications, called on the producer thread as blocks of rows of the writable frame complete.
+  // Must not be changed while the producer is active.
+  using slice_handler = void (*)(void* ctx, const frame_slice& slice);
+  void set_slice_handler(slice_handler handler, void* ctx)
+  {
+    slice_handler_ = handler;
+    slice_handler_ctx_ = ctx;
+  }
+  bool has_slice_handler() const { return slice_handler_ != nullptr; }
+
   std::span<uint8_t> writable_frame();
-  void finish_writing();
+  // Rows [first_row, first_row + num_rows) of the writable frame are complete
+  void publish_slice(std::size_t row_size, std::size_t first_row, std::size_t num_rows, std::uint64_t sequence);
+  void finish_writing(const frame_metadata& metadata = {});
 
   std::span<std::uint8_t> readable_frame_wait();
 
   template <class Rep, class Period>
   std::span<std::uint8_t> readable_frame_wait_for(const std::chrono::duration<Rep, Period>& rel_time)
   {
+    notify_read();
     std::unique_lock lock(mutex_);
     if (new_frame_condition_.wait_for(lock, rel_time, [this]() {
           return used_ != 0;
@@ -53,6 +123,7 @@ public:
   template <class Clock, class Duration>
   std::span<std::uint8_t> readable_frame_wait_until(const std::chrono::time_point<Clock, Duration>& abs_time)
   {
+    notify_read();
     std::unique_lock lock(mutex_);
     if (new_frame_condition_.wait_until(lock, abs_time, [this]() {
           return used_ != 0;
@@ -60,13 +131,26 @@ public:
       return readable_frame_nowait_locked();
     return {};
   }
+  // Metadata of the frame returned by readable_frame_*(), valid until finish_reading()
+  const frame_metadata& readable_metadata() const { return metadata_[tail_]; }
   void finish_reading();
 
 private:
+  void notify_read()
+  {
+    if (read_handler_)
+      read_handler_(read_handler_ctx_);
+  }
   std::span<std::uint8_t> readable_frame_nowait_locked();
 
+  read_handler read_handler_ = nullptr;
+  void* read_handler_ctx_ = nullptr;
+  slice_handler slice_handler_ = nullptr;
+  void* slice_handler_ctx_ = nullptr;
+
   std::size_t frame_size_;
   std::unique_ptr<uint8_t[]> frames_;
+  std::unique_ptr<frame_metadata[]> metadata_;
   std::uint32_t num_frames_;
 
   std::uint32_t head_ = 0;
@@ -0,0 +1,80 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_SPSCQUEUE_HPP
+#define PSEYE_DRIVER_SPSCQUEUE_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+/// Bounded lock-free single-producer single-consumer queue for small trivially copyable values
+template <typename T>
+class spsc_queue
+{
+public:
+  spsc_queue() = default;
+  explicit spsc_queue(std::size_t capacity) { reset(capacity); }
+
+  // NOTE: neither side may be active while resetting
+  void reset(std::size_t capacity)
+  {
+    items_.assign(capacity + 1, T{});
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+  }
+
+  // Producer side
+  bool try_push(const T& value)
+  {
+    const auto head = head_.load(std::memory_order_relaxed);
+    const auto next = head + 1 != items_.size() ? head + 1 : 0;
+    if (next == tail_.load(std::memory_order_acquire))
+      return false; // full
+    items_[head] = value;
+    head_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  bool try_pop(T& value)
+  {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire))
+      return false; // empty
+    value = items_[tail];
+    tail_.store(tail + 1 != items_.size() ? tail + 1 : 0, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const { return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire); }
+
+private:
+  std::vector<T> items_;
+  // keep producer and consumer indices on separate cache lines
+  alignas(64) std::atomic<std::size_t> head_ = 0;
+  alignas(64) std::atomic<std::size_t> tail_ = 0;
+};
+
+PSEYE_NS_END
+
+#endif
@@ -0,0 +1,67 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_USBCAMERATRANSPORT_HPP
+#define PSEYE_DRIVER_USBCAMERATRANSPORT_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "pseye/driver/camera_transport.hpp"
+#include "pseye/driver/pseye_device_controller.hpp"
+#include "pseye/driver/usb_transfer_controller.hpp"
+
+PSEYE_NS_BEGIN
+
+/// Streams from an actual PlayStation Eye via libusb
+class usb_camera_transport final : public camera_transport
+{
+public:
+  explicit usb_camera_transport(libusb_device* device);
+  explicit usb_camera_transport(libusb_device_handle* device);
+  usb_camera_transport(libusb_device_handle* device, const pseye_endpoints& endpoints);
+  ~usb_camera_transport() override;
+
+  camera_stream_layout configure(pseye_device_state& state, const usb_stream_options& options) override;
+  void start() override;
+  void stop() override;
+  void release_buffer(std::uint8_t* buffer) override { transfer_.release_buffer(buffer); }
+  void suspend() override;
+  void resume() override;
+
+  pseye_device_controller& device() { return handle_; }
+  usb_buffer_allocation buffer_allocation() const { return transfer_.buffer_allocation(); }
+  usb_tuning_state tuning_state() const { return transfer_.tuning_state(); }
+  usb_transfer_statistics statistics() const { return transfer_.statistics(); }
+
+private:
+  static void on_transfer_data(void* ctx, std::span<std::uint8_t> data);
+  static void on_recovery(void* ctx, const usb_recovery_info& info);
+  void initialize();
+
+  pseye_device_controller handle_;
+  usb_transfer_controller transfer_;
+  usb_transfer_settings transfer_settings_;
+  ov534::transfer transfer_mode_ = ov534::transfer::bulk;
+  bool is_active_ = false;
+  // Reported by |transfer_|, talking to the device is pointless from then on
+  std::atomic<bool> device_lost_ = false;
+};
+
+PSEYE_NS_END
+
+#endif
@@ -21,8 +21,18 @@
 #pragma once
 #endif
 
+#include "pseye/thread.hpp"
+
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <thread>
+#include <utility>
+#include <vector>
 
 typedef struct libusb_context libusb_context;
 typedef struct libusb_device libusb_device;
@@ -34,36 +44,142 @@ enum libusb_transfer_type;
 
 PSEYE_NS_BEGIN
 
+struct usb_hotplug_registration;
+class pseye_topology_cache;
+
+enum class usb_hotplug_event
+{
+  arrived,
+  left,
+};
+
+enum class usb_event_loop_assignment
+{
+  // Each opened device goes to the next event loop
+  round_robin,
+  // All devices on one bus (i.e. host controller) share an event loop, buses are spread round-robin
+  per_bus,
+};
+
+struct usb_context_options
+{
+  // The event thread runs all transfer completions (and with them, frame assembly unless pipelined).
+  // With multiple event loops, thread i is named "<name>-<i>" and pinned to cpu_affinity[i % size] (if any).
+  thread_options event_thread{.name = "pseye-usb"};
+  // Poll for events with a zero timeout instead of blocking: lowest completion latency, but burns a core
+  bool busy_poll = false;
+  // Independent libusb contexts, each with its own event thread, so completions of different cameras can be
+  // handled in parallel
+  std::size_t num_event_loops = 1;
+  usb_event_loop_assignment assignment = usb_event_loop_assignment::round_robin;
+  // Don't spawn event threads, the application polls pollfds() and calls handle_events_nonblocking() instead.
+  // NOTE: stopping a stream waits for its transfers to be cancelled, so don't do that on the polling thread.
+  bool external_event_loop = false;
+  // Skip scanning the bus on startup (Linux only): devices can then only be opened via wrap_device(), neither
+  // enumeration, hotplug nor reconnecting will find anything
+  bool no_device_discovery = false;
+};
+
+/// File descriptor libusb wants polled, |events| are POLLIN/POLLOUT flags
+struct usb_pollfd
+{
+  int fd = -1;
+  short events = 0;
+};
+
 class usb_context
 {
 public:
-  usb_context();
+  explicit usb_context(const usb_context_options& options = {});
   ~usb_context();
 
+  // Devices opened from |event_loop|'s list complete their transfers on its thread
   template <typename Handler>
-  void for_each_device(Handler&& handler)
+  void for_each_device(Handler&& handler, std::size_t event_loop = 0)
   {
     for_each_device_aux(
+        event_loop,
         [](void* ctx, libusb_device* dev, const libusb_device_descriptor& desc) {
           auto& handler = *static_cast<Handler*>(ctx);
           handler(dev, desc);
         },
         &handler);
   }
+  // Goes through the topology cache (if any) for PS Eye cameras
   libusb_device_handle* open_device(std::uint16_t vendor_id, std::uint16_t product_id);
+  // Opens the device behind an already open (usbfs) file descriptor, e.g. one passed to a sandboxed process.
+  // |fd| must stay open as long as the returned handle.
+  libusb_device_handle* wrap_device(std::intptr_t fd);
+
+  // External event loop only: poll these (of all event loops), handle_events_nonblocking() once any is ready or
+  // next_timeout() expired. Not available on Windows (empty).
+  std::vector<usb_pollfd> pollfds() const;
+  // Keeps a reactor's registrations in sync with pollfds(), called from within libusb (no libusb calls allowed)
+  using pollfd_added_handler = void (*)(void* ctx, int fd, short events);
+  using pollfd_removed_handler = void (*)(void* ctx, int fd);
+  void set_pollfd_handlers(pollfd_added_handler added, pollfd_removed_handler removed, void* ctx);
+  // Time until libusb has to handle a transfer timeout even if no fd becomes ready, nullopt if there's none pending
+  std::optional<std::chrono::microseconds> next_timeout() const;
+  // Runs any ready completions (and with them the data handlers) of all event loops without blocking
+  void handle_events_nonblocking();
+
+  std::size_t num_event_loops() const { return event_loops_.size(); }
+  // Picks the event loop for the next device opened on |bus_number| according to our assignment policy
+  std::size_t assign_event_loop(std::uint8_t bus_number);
+  // Same, but the device plugged into |port_path| keeps the event loop it got the first time, e.g. across reopens
+  std::size_t assign_event_loop(std::uint8_t bus_number, std::span<const std::uint8_t> port_path);
+
+  // Makes open_device(), enumerate_pseye_devices() and open_pseye_device() use |cache| instead of scanning the bus,
+  // nullptr to scan again. |cache| has to be one of this context's.
+  void set_topology_cache(pseye_topology_cache* cache) { topology_cache_.store(cache, std::memory_order_release); }
+  pseye_topology_cache* topology_cache() const { return topology_cache_.load(std::memory_order_acquire); }
+
+  using hotplug_handler = void (*)(void* ctx, usb_hotplug_event event, libusb_device* device);
+
+  // Calls |handler| on the event thread whenever a matching device arrives or leaves; sync I/O isn't allowed there.
+  // Returns an id for remove_hotplug_handler(), 0 if the platform doesn't support hotplug events (e.g. Windows).
+  int add_hotplug_handler(std::uint16_t vendor_id, std::uint16_t product_id, hotplug_handler handler, void* ctx);
+  void remove_hotplug_handler(int id);
 
 private:
-  void for_each_device_aux(void (*cb)(void* ctx, libusb_device* dev, const libusb_device_descriptor& desc), void* ctx);
-  void run_event_loop() const;
+  struct event_loop
+  {
+    libusb_context* context = nullptr;
+    std::thread thread;
+  };
+
+  void for_each_device_aux(std::size_t event_loop,
+                           void (*cb)(void* ctx, libusb_device* dev, const libusb_device_descriptor& desc),
+                           void* ctx);
+  void run_event_loop(std::size_t index) const;
+  std::size_t assign_event_loop_locked(std::uint8_t bus_number);
+  static void on_pollfd_added(int fd, short events, void* user_data);
+  static void on_pollfd_removed(int fd, void* user_data);
 
-  libusb_context* usb_context_ = nullptr;
-  std::thread event_loop_thread_;
+  usb_context_options options_;
+  // The first event loop also handles hotplug events
+  std::vector<event_loop> event_loops_;
   std::atomic<bool> exit_requested_ = false;
+
+  pollfd_added_handler pollfd_added_ = nullptr;
+  pollfd_removed_handler pollfd_removed_ = nullptr;
+  void* pollfd_ctx_ = nullptr;
+
+  std::mutex assignment_mutex_;
+  std::size_t next_event_loop_ = 0;
+  std::vector<std::pair<std::uint8_t, std::size_t>> bus_event_loops_;
+  // Bus number followed by the port path
+  std::vector<std::pair<std::vector<std::uint8_t>, std::size_t>> port_event_loops_;
+  std::atomic<pseye_topology_cache*> topology_cache_ = nullptr;
+
+  std::mutex hotplug_mutex_;
+  std::vector<std::unique_ptr<usb_hotplug_registration>> hotplug_registrations_;
 };
 
 const libusb_endpoint_descriptor* find_endpoint(libusb_config_descriptor* config,
                                                 std::uint8_t interface_index,
-                                                libusb_transfer_type type);
+                                                libusb_transfer_type type,
+                                                std::uint8_t* alternate_setting = nullptr);
 
 PSEYE_NS_END
 
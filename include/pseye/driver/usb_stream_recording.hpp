@@ -0,0 +1,143 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_USBSTREAMRECORDING_HPP
+#define PSEYE_DRIVER_USBSTREAMRECORDING_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "pseye/pixel_format.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+/// Describes the stream contained in a recording
+struct usb_stream_header
+{
+  std::uint32_t payload_size = 0;
+  std::uint32_t width = 0, height = 0;
+  pixel_format format = pixel_format::grbg8;
+  std::uint32_t rate = 0;
+};
+
+/// Writes the raw data of completed transfers (with their completion times) to a file.
+///
+/// File layout (little-endian):
+///   "PSEYEUSB" u32:version u32:payload_size u32:width u32:height u32:format u32:rate
+///   followed by records of u64:completion time in ns (relative to the first record) u32:length u8[length]:data
+class usb_stream_recorder
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit usb_stream_recorder(const std::string& filename);
+  ~usb_stream_recorder();
+
+  usb_stream_recorder(const usb_stream_recorder&) = delete;
+  usb_stream_recorder& operator=(const usb_stream_recorder&) = delete;
+
+  // Writes the file header, subsequent calls are ignored
+  void begin(const usb_stream_header& header);
+  // NOTE: must always be called from the same thread (or at least not concurrently)
+  void write(clock::time_point completion_time, std::span<const std::uint8_t> data);
+
+private:
+  std::FILE* file_ = nullptr;
+  bool has_header_ = false;
+  clock::time_point first_completion_{};
+};
+
+/// A recording loaded into memory, can be shared by any number of players
+class usb_stream_recording
+{
+public:
+  struct record
+  {
+    std::chrono::nanoseconds completion_time;
+    std::size_t offset;
+    std::uint32_t length;
+  };
+
+  static std::shared_ptr<const usb_stream_recording> load(const std::string& filename);
+
+  const usb_stream_header& header() const { return header_; }
+  std::span<const record> records() const { return records_; }
+  std::span<const std::uint8_t> data(const record& r) const { return std::span(data_).subspan(r.offset, r.length); }
+  std::size_t max_record_size() const { return max_record_size_; }
+
+private:
+  usb_stream_header header_;
+  std::vector<record> records_;
+  std::vector<std::uint8_t> data_;
+  std::size_t max_record_size_ = 0;
+};
+
+struct usb_replay_options
+{
+  // Honor the recorded completion times instead of replaying as fast as possible
+  bool real_time = true;
+  bool loop = false;
+};
+
+/// Feeds a recording to a data handler from its own thread, just like usb_transfer_controller would
+class usb_stream_player
+{
+public:
+  using data_handler = void (*)(void* ctx, std::span<std::uint8_t> data);
+
+  usb_stream_player(std::shared_ptr<const usb_stream_recording> recording, data_handler handler, void* ctx);
+  ~usb_stream_player() { stop(); }
+
+  usb_stream_player(const usb_stream_player&) = delete;
+  usb_stream_player& operator=(const usb_stream_player&) = delete;
+
+  void start(const usb_replay_options& options = {});
+  // Interrupts the replay
+  void stop();
+  // Waits for a non-looping replay to finish
+  void wait();
+
+  const usb_stream_header& header() const { return recording_->header(); }
+  std::uint64_t num_replayed() const { return num_replayed_.load(std::memory_order_relaxed); }
+
+private:
+  void run(usb_replay_options options);
+
+  std::shared_ptr<const usb_stream_recording> recording_;
+  data_handler handler_;
+  void* handler_ctx_;
+
+  // handlers get a private copy, like a transfer buffer
+  std::vector<std::uint8_t> transfer_buffer_;
+  std::thread thread_;
+  std::atomic<bool> stop_requested_ = false;
+  std::atomic<std::uint64_t> num_replayed_ = 0;
+};
+
+PSEYE_NS_END
+
+#endif
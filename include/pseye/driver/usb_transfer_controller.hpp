@@ -16,14 +16,21 @@
 #define PSEYE_DRIVER_USBTRANSFERCONTROLLER_HPP
 
 #include "pseye/detail/config.hpp"
+#include "pseye/driver/spsc_queue.hpp"
+#include "pseye/driver/usb_transfer_telemetry.hpp"
+#include "pseye/driver/usb_transfer_tuner.hpp"
 
 #if PSEYE_HAS_PRAGMA_ONCE
 # pragma once
 #endif
 
-#include <functional>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
 #include <span>
+#include <thread>
+#include <vector>
 
 struct libusb_transfer;
 typedef struct libusb_device_handle libusb_device_handle;
@@ -35,35 +42,179 @@ struct free_libusb_transfer
   void operator()(libusb_transfer* transfer) const;
 };
 
-/// Helper class for raw bulk data transfers
-// TODO: iso support?
+enum class usb_buffer_allocation
+{
+  heap,
+  // usbfs memory mapped into our address space (Linux only), saves the kernel a copy per transfer
+  device_memory,
+};
+
+/// Layout of the transfers kept in flight by usb_transfer_controller
+struct usb_transfer_settings
+{
+  std::uint8_t endpoint = 0;
+  std::size_t num_transfers = 0;
+  std::size_t transfer_size = 0;
+  // Isochronous endpoints only: each transfer is split into this many equally-sized packets
+  std::size_t num_iso_packets = 0;
+  // Preferred allocation; falls back to |heap| if the platform doesn't support device memory
+  usb_buffer_allocation buffer_allocation = usb_buffer_allocation::heap;
+  // Bulk endpoints only: let the controller adjust |num_transfers| and |transfer_size| while streaming
+  usb_transfer_tuning tuning;
+  // Bulk endpoints only: if non-zero, completed buffers are handed over to the data handler, which gives them back via
+  // usb_transfer_controller::release_buffer(). Meanwhile, transfers are resubmitted with one of these spare buffers.
+  std::size_t num_spare_buffers = 0;
+  // Recover from stalls & transfer errors in place (clear the halt, refill the transfers) this many times in a row
+  // before giving up, 0 disables recovery
+  std::size_t max_recovery_attempts = 3;
+};
+
+enum class usb_recovery_event
+{
+  // The stream stopped, we're about to clear the halt
+  halted,
+  // Transfers are about to be resubmitted, data of the interrupted frame might still be in-flight
+  recovered,
+  // Out of attempts (or the device is gone), the stream stays stopped
+  failed,
+  // The device is gone (unplugged, hub reset), nothing is going to be resubmitted
+  device_lost,
+};
+
+struct usb_recovery_info
+{
+  usb_recovery_event event = usb_recovery_event::halted;
+  // libusb_transfer_status that caused the recovery
+  int status = 0;
+  // Attempts since we last received data
+  std::size_t attempt = 0;
+  // Time since the stream halted
+  std::chrono::steady_clock::duration downtime{};
+};
+
+/// Helper class for raw bulk or isochronous data transfers
+/// NOTE: completions are handled without taking locks or allocating, |handler| is called on the libusb event thread.
 class usb_transfer_controller
 {
 public:
-  // TODO: std::invocable?
-  template <typename Handler>
-  usb_transfer_controller(Handler&& handler)
-    : handler_(std::forward<Handler>(handler))
+  using data_handler = void (*)(void* ctx, std::span<std::uint8_t> data);
+  using recovery_handler = void (*)(void* ctx, const usb_recovery_info& info);
+
+  usb_transfer_controller(data_handler handler, void* ctx)
+    : handler_(handler)
+    , handler_ctx_(ctx)
   {
   }
 
-  ~usb_transfer_controller() { stop(); }
+  ~usb_transfer_controller()
+  {
+    stop();
+    free_buffer();
+  }
 
-  bool start(libusb_device_handle* handle, std::uint8_t endpoint, std::size_t num_transfers, std::size_t transfer_size);
+  bool start(libusb_device_handle* handle, const usb_transfer_settings& settings);
   void stop();
+  // Parks all transfers (without freeing anything) until resume(), must not be called from the event thread
+  void pause();
+  void resume();
+
+  // Called from the recovery thread (which must not be stopped from within), must not be changed while streaming
+  void set_recovery_handler(recovery_handler handler, void* ctx)
+  {
+    recovery_handler_ = handler;
+    recovery_handler_ctx_ = ctx;
+  }
+
+  // Allocation of the transfer buffers actually in use
+  usb_buffer_allocation buffer_allocation() const { return buffer_allocation_; }
+  // Current auto-tuning decision (if enabled)
+  usb_tuning_state tuning_state() const { return tuner_.state(); }
+
+  // Buffer hand-off only: return a buffer passed to the data handler, must be called from a single thread
+  void release_buffer(std::uint8_t* buffer) { free_buffers_.try_push(buffer); }
+  // Buffer hand-off only: number of completed transfers dropped because no spare buffer was available
+  std::uint64_t num_dropped_transfers() const { return num_dropped_transfers_.load(std::memory_order_relaxed); }
+
+  // Counters & histograms since start(), cheap enough to poll a couple of times per second
+  usb_transfer_statistics statistics() const;
+
+  // Passes each packet of a completed isochronous |transfer| to |handler| on its own, skipping empty & failed ones.
+  // Returns the number of bytes passed on, |num_bad_packets| is increased by the number of failed packets.
+  static std::size_t deliver_iso_packets(libusb_transfer* transfer,
+                                         data_handler handler,
+                                         void* ctx,
+                                         std::uint64_t& num_bad_packets);
 
 private:
-  void free_transfer(libusb_transfer* transfer);
+  void allocate_buffer(libusb_device_handle* handle, std::size_t size, usb_buffer_allocation preferred);
+  void free_buffer();
+  void retire_transfer();
+  int submit_transfer(libusb_transfer* transfer);
+  void resubmit_parked_transfers();
+  std::vector<libusb_transfer*> take_refill();
+  void submit_refill(const std::vector<libusb_transfer*>& refill);
+  void park_transfer(libusb_transfer* transfer);
+  void begin_recovery(libusb_transfer* transfer);
+  void run_recovery();
+  void recover();
+  void report_recovery(usb_recovery_event event, usb_recovery_info& info);
   void process_done(libusb_transfer* transfer);
 
-  std::function<void(std::span<std::uint8_t> data)> handler_;
+  // libusb_transfer::user_data points to the transfer's slot
+  struct transfer_slot
+  {
+    usb_transfer_controller* owner = nullptr;
+    std::size_t index = 0;
+    std::unique_ptr<libusb_transfer, free_libusb_transfer> transfer;
+  };
+
+  data_handler handler_;
+  void* handler_ctx_;
+  recovery_handler recovery_handler_ = nullptr;
+  void* recovery_handler_ctx_ = nullptr;
+
+  libusb_device_handle* handle_ = nullptr;
+  std::uint8_t endpoint_ = 0;
+  bool is_iso_ = false;
+  std::size_t num_transfers_ = 0;
+
+  libusb_device_handle* buffer_owner_ = nullptr;
+  std::uint8_t* transfer_buffer_ = nullptr;
+  std::size_t transfer_buffer_size_ = 0;
+  usb_buffer_allocation buffer_allocation_ = usb_buffer_allocation::heap;
+  std::vector<transfer_slot> slots_;
+
+  // Transfers held back by the tuner, a recovery or a pause; only touched by start(), the serialized completions and
+  // (while no transfer is active) resume() & the recovery thread. The latter two take the refill under
+  // |parked_mutex_|, since a pause and a recovery may overlap.
+  bool tuning_enabled_ = false;
+  usb_transfer_tuner tuner_;
+  std::vector<libusb_transfer*> parked_transfers_;
+  std::mutex parked_mutex_;
+
+  // In-place recovery: completions park their transfers until |recovery_thread_| cleared the halt.
+  // The thread also reports a lost device, which isn't worth recovering.
+  std::size_t max_recovery_attempts_ = 0;
+  std::atomic<bool> recovering_ = false;
+  std::atomic<bool> paused_ = false;
+  std::atomic<bool> device_lost_ = false;
+  bool device_lost_reported_ = false;
+  std::atomic<std::uint32_t> recovery_signal_ = 0;
+  std::atomic<std::uint32_t> recovery_attempts_ = 0;
+  int recovery_status_ = 0;
+  std::atomic<std::chrono::steady_clock::time_point> halt_time_{};
+  std::thread recovery_thread_;
+
+  // Buffer hand-off: spare buffers not currently owned by a transfer or the data handler
+  bool handoff_enabled_ = false;
+  spsc_queue<std::uint8_t*> free_buffers_;
+  std::atomic<std::uint64_t> num_dropped_transfers_ = 0;
+  std::atomic<std::uint64_t> num_bad_iso_packets_ = 0;
 
-  std::unique_ptr<uint8_t[]> transfer_buffer_;
-  std::vector<std::unique_ptr<libusb_transfer, free_libusb_transfer>> transfers_;
+  usb_transfer_telemetry telemetry_;
 
-  std::mutex active_transfers_mutex_;
-  std::condition_variable transfer_done_condition_;
-  uint8_t num_active_transfers_ = 0;
+  std::atomic<std::uint32_t> num_active_transfers_ = 0;
+  std::atomic<bool> stop_requested_ = false;
 };
 
 PSEYE_NS_END
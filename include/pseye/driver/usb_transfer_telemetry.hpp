@@ -0,0 +1,131 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_USBTRANSFERTELEMETRY_HPP
+#define PSEYE_DRIVER_USBTRANSFERTELEMETRY_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+PSEYE_NS_BEGIN
+
+/// Power-of-two histogram: bucket 0 counts zeros, bucket i > 0 counts values in [2^(i-1), 2^i)
+struct usb_histogram
+{
+  static constexpr std::size_t num_buckets = 32;
+
+  // Smallest bucket bound that at least |fraction| of the samples are below
+  std::uint64_t percentile(double fraction) const;
+  std::uint64_t total() const;
+
+  std::array<std::uint64_t, num_buckets> counts{};
+};
+
+/// Snapshot of usb_transfer_telemetry, see usb_transfer_controller::statistics()
+struct usb_transfer_statistics
+{
+  // One past the largest libusb_transfer_status
+  static constexpr std::size_t num_statuses = 7;
+
+  // Since the controller was started
+  std::chrono::steady_clock::duration elapsed{};
+  std::uint64_t num_bytes = 0;
+  std::uint64_t num_completions = 0;
+  // Over the last second (or less, if we didn't stream for a second yet)
+  double bytes_per_second = 0;
+  // Microseconds between successful completions
+  usb_histogram completion_interval;
+  // Bytes per successful completion
+  usb_histogram actual_length;
+  // Indexed by libusb_transfer_status
+  std::array<std::uint64_t, num_statuses> completions_by_status{};
+  std::array<std::uint64_t, num_statuses> resubmits_by_status{};
+  std::uint64_t num_recoveries = 0;
+  std::uint64_t num_dropped_transfers = 0;
+  // Isochronous packets that failed (and were skipped) within otherwise completed transfers
+  std::uint64_t num_bad_iso_packets = 0;
+  std::uint32_t in_flight = 0;
+  // Longest time without a successful completion, including the one still ongoing
+  std::chrono::steady_clock::duration longest_gap{};
+};
+
+/// Always-on transfer counters.
+/// The record functions are meant to be called from the (serialized) completion callbacks, snapshot() from anywhere.
+class usb_transfer_telemetry
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  void reset(clock::time_point now);
+
+  void record_completion(clock::time_point now, int status, std::size_t actual_length);
+  void record_resubmit(int status) { increment(resubmits_by_status_[index(status)]); }
+  // Called by the controller before resubmitting after a pause, so the paused time isn't counted as a gap
+  void record_resume(clock::time_point now);
+  // May be called from any thread
+  void record_recovery() { num_recoveries_.fetch_add(1, std::memory_order_relaxed); }
+
+  // Fills everything but |in_flight|, |num_dropped_transfers| and |num_bad_iso_packets|, which the controller knows
+  // better.
+  // |streaming| includes the time since the last completion in |longest_gap|.
+  usb_transfer_statistics snapshot(clock::time_point now, bool streaming) const;
+
+private:
+  using counter = std::atomic<std::uint64_t>;
+
+  // Single writer, so we can do without a locked RMW
+  static void increment(counter& c, std::uint64_t n = 1)
+  {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  static std::size_t index(int status)
+  {
+    return static_cast<std::size_t>(status) < usb_transfer_statistics::num_statuses ? static_cast<std::size_t>(status)
+                                                                                      : 0;
+  }
+  static void store_max(std::atomic<clock::rep>& value, clock::rep candidate)
+  {
+    if (candidate > value.load(std::memory_order_relaxed))
+      value.store(candidate, std::memory_order_relaxed);
+  }
+
+  // Only touched by the recording thread
+  clock::time_point rate_window_start_{};
+  std::uint64_t rate_window_bytes_ = 0;
+
+  std::atomic<clock::rep> start_time_ = 0;
+  std::atomic<clock::rep> last_completion_ = 0;
+  counter num_bytes_ = 0;
+  counter num_completions_ = 0;
+  std::atomic<double> bytes_per_second_ = 0;
+  std::array<counter, usb_histogram::num_buckets> completion_interval_{};
+  std::array<counter, usb_histogram::num_buckets> actual_length_{};
+  std::array<counter, usb_transfer_statistics::num_statuses> completions_by_status_{};
+  std::array<counter, usb_transfer_statistics::num_statuses> resubmits_by_status_{};
+  counter num_recoveries_ = 0;
+  std::atomic<clock::rep> longest_gap_ = 0;
+};
+
+PSEYE_NS_END
+
+#endif
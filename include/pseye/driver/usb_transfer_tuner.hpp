@@ -0,0 +1,108 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_USBTRANSFERTUNER_HPP
+#define PSEYE_DRIVER_USBTRANSFERTUNER_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+PSEYE_NS_BEGIN
+
+enum class usb_tuning_goal
+{
+  latency,    // transfers of (fractions of) a frame that fill up within |target_latency|
+  throughput, // whole-frame transfers, fewest completions
+};
+
+/// Bounds and targets for usb_transfer_tuner
+struct usb_transfer_tuning
+{
+  bool enabled = false;
+  usb_tuning_goal goal = usb_tuning_goal::latency;
+  std::size_t min_transfers = 2;
+  std::size_t max_transfers = 16;
+  // Transfer lengths are always multiples of this (i.e. the UVC payload size)
+  std::size_t granularity = 2 * 1024;
+  std::size_t max_transfer_size = 0x40000;
+  // Bytes per frame on the wire (including payload headers), 0 if unknown
+  std::size_t frame_size = 0;
+  // Data in flight should cover this much time so that a stalled event thread doesn't drop frames
+  std::chrono::microseconds headroom{8000};
+  // Latency goal only: upper bound for the time it takes to fill a single transfer
+  std::chrono::microseconds target_latency{2000};
+  // Number of completions between two decisions
+  std::uint32_t window = 128;
+};
+
+/// Measurements and decision of the last usb_transfer_tuner window
+struct usb_tuning_state
+{
+  std::size_t num_transfers = 0;
+  std::size_t transfer_size = 0;
+  double bytes_per_second = 0;
+  std::chrono::microseconds mean_interval{0};
+  std::chrono::microseconds max_interval{0};
+  float fill_ratio = 0;
+  std::uint32_t adjustments = 0;
+};
+
+/// Picks the in-flight transfer depth and length from observed completion intervals and fill levels.
+/// record() is meant to be called from the (serialized) completion callbacks, state() from anywhere.
+class usb_transfer_tuner
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  void reset(const usb_transfer_tuning& tuning, std::size_t num_transfers, std::size_t transfer_size);
+
+  // Returns true if the window ended with a changed decision
+  bool record(clock::time_point now, std::size_t actual_length, std::size_t length);
+
+  std::size_t num_transfers() const { return num_transfers_.load(std::memory_order_relaxed); }
+  std::size_t transfer_size() const { return transfer_size_.load(std::memory_order_relaxed); }
+  usb_tuning_state state() const;
+
+private:
+  bool decide(clock::time_point now);
+
+  usb_transfer_tuning tuning_;
+
+  clock::time_point window_start_{};
+  clock::time_point last_completion_{};
+  clock::duration window_max_interval_{};
+  std::uint64_t window_bytes_ = 0;
+  std::uint64_t window_capacity_ = 0;
+  std::uint32_t window_completions_ = 0;
+
+  std::atomic<std::size_t> num_transfers_ = 0;
+  std::atomic<std::size_t> transfer_size_ = 0;
+  std::atomic<double> bytes_per_second_ = 0;
+  std::atomic<std::int64_t> mean_interval_us_ = 0;
+  std::atomic<std::int64_t> max_interval_us_ = 0;
+  std::atomic<float> fill_ratio_ = 0;
+  std::atomic<std::uint32_t> adjustments_ = 0;
+};
+
+PSEYE_NS_END
+
+#endif
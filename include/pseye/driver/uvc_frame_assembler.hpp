@@ -0,0 +1,105 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_DRIVER_UVCFRAMEASSEMBLER_HPP
+#define PSEYE_DRIVER_UVCFRAMEASSEMBLER_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "pseye/driver/device_clock_estimator.hpp"
+#include "pseye/driver/segmented_frame_queue.hpp"
+#include "pseye/driver/uvc_frame_processor.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+class spsc_frame_buffer;
+
+/// Splits raw transfer data into UVC payloads and assembles them into the frames of a spsc_frame_buffer,
+/// or (zero-copy) into segmented frames referencing the transfer buffers themselves.
+/// Frames get their capture time from correlating each frame's SCR (or PTS) with the time it was received.
+class uvc_frame_assembler
+{
+public:
+  // Also forgets about any partially assembled frame
+  void reset(spsc_frame_buffer* frame_buffer, std::uint32_t payload_size);
+  // Zero-copy mode: transfer data has to be passed to put_pinned()
+  void reset(segmented_frame_queue* frames,
+             pinned_buffer_pool* pool,
+             std::size_t frame_size,
+             std::uint32_t payload_size);
+
+  // |completion_time| is when |data| was received, it ends up in the metadata of the frames it completes
+  void put(std::span<const std::uint8_t> data, std::chrono::steady_clock::time_point completion_time = {});
+  // Zero-copy mode: takes over the transfer buffer |data|, which goes back to the pool once no frame references it
+  void put_pinned(std::span<std::uint8_t> data, std::chrono::steady_clock::time_point completion_time = {});
+  // Zero-copy mode: gives back all buffers held for the frame being assembled (which is dropped)
+  void release_pins();
+  // see uvc_frame_processor::resync()
+  void resync() { processor_.resync(); }
+  // see uvc_frame_processor::set_salvage_mode(), must be called after reset()
+  void set_salvage_mode(std::size_t row_size) { processor_.set_salvage_mode(row_size); }
+  // Publishes slices of |rows_per_slice| rows (|row_size| bytes each) to the frame buffer, 0 disables them.
+  // Must be called after reset(), the zero-copy mode doesn't support slices.
+  void set_slice_rows(std::size_t row_size, std::size_t rows_per_slice)
+  {
+    slice_row_size_ = row_size;
+    rows_per_slice_ = rows_per_slice;
+  }
+  // Ticks per second of the device clock, see camera_stream_layout::clock_frequency
+  void set_clock_frequency(std::uint32_t frequency) { clock_ = device_clock_estimator(frequency); }
+
+private:
+  void begin_frame();
+  void finish_frame(std::chrono::steady_clock::time_point completion_time);
+  void publish_slices();
+
+  // Pinned transfer buffers the frame being assembled might point into, oldest first
+  struct held_buffer
+  {
+    const std::uint8_t* begin;
+    const std::uint8_t* end;
+    buffer_pin pin;
+  };
+
+  uvc_frame_processor processor_;
+  spsc_frame_buffer* frame_buffer_ = nullptr;
+  segmented_frame_queue* segmented_frames_ = nullptr;
+  pinned_buffer_pool* pool_ = nullptr;
+  std::size_t frame_size_ = 0;
+  std::vector<held_buffer> held_;
+  std::uint32_t payload_size_ = 0;
+  std::uint64_t frame_sequence_ = 0;
+
+  // Sub-frame slices: rows of the frame started |slice_frame_| that were published already
+  std::size_t slice_row_size_ = 0;
+  std::size_t rows_per_slice_ = 0;
+  std::uint32_t slice_frame_ = 0;
+  std::size_t published_rows_ = 0;
+  device_clock_estimator clock_;
+  // The estimator is fed with SCRs once the stream has them, PTSs otherwise
+  bool clock_uses_scr_ = false;
+};
+
+PSEYE_NS_END
+
+#endif
@@ -16,12 +16,18 @@
 #define PSEYE_DRIVER_UVCFRAMEPROCESSOR_HPP
 
 #include "pseye/detail/config.hpp"
+#include "pseye/driver/spsc_frame_buffer.hpp"
 
 #if PSEYE_HAS_PRAGMA_ONCE
 # pragma once
 #endif
 
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <span>
+#include <vector>
 
 PSEYE_NS_BEGIN
 
@@ -36,15 +42,77 @@ public:
     frame_complete,
   };
 
-  void set_frame(std::span<std::uint8_t> frame) { current_frame_ = frame; }
+  void set_frame(std::span<std::uint8_t> frame)
+  {
+    current_frame_ = frame;
+    segments_ = nullptr;
+    frame_capacity_ = frame.size();
+  }
+  // Zero-copy mode: instead of copying the payload data into a frame, |segments| gets a view of each payload.
+  // The views are only valid as long as the data passed to put() is, it's up to the caller to keep that alive.
+  void set_segmented_frame(std::vector<std::span<const std::uint8_t>>* segments, std::size_t frame_size)
+  {
+    current_frame_ = {};
+    segments_ = segments;
+    frame_capacity_ = frame_size;
+  }
   status put(std::span<const std::uint8_t> data);
+  // Same as calling put() for each |payload_size| chunk of |data| (the last one may be shorter), stopping at the first
+  // chunk that doesn't return need_data. |consumed| is the number of bytes processed, which includes a completing
+  // chunk but not one asking for a buffer.
+  status put_batch(std::span<const std::uint8_t> data, std::size_t payload_size, std::size_t& consumed);
+  // Bytes of the current frame assembled so far
+  std::size_t frame_length() const { return frame_len_; }
+  // Incremented whenever a new frame begins
+  std::uint32_t frame_starts() const { return frame_starts_; }
+  // PTS of the frame currently being assembled (or just completed)
+  std::uint32_t frame_pts() const { return frame_pts_; }
+  // SCR (STC & SOF) of the last payload carrying one in the current frame, 0 if none did
+  std::uint32_t frame_scr() const { return frame_scr_; }
+  std::uint16_t frame_sof() const { return frame_sof_; }
+  // Host time the data passed to put() next was received, the first payload of a frame records it
+  void set_receive_time(std::chrono::steady_clock::time_point time) { receive_time_ = time; }
+  std::chrono::steady_clock::time_point first_payload_time() const { return first_payload_time_; }
+  // Salvage mode: damaged frames are completed anyway, with their errors and damaged rows (|row_size| bytes each)
+  // recorded. 0 restores the default strict mode, which drops them.
+  void set_salvage_mode(std::size_t row_size) { row_size_ = row_size; }
+  // Salvage mode only: frame_error_* flags & damaged rows of the frame currently being assembled (or just completed)
+  std::uint8_t frame_errors() const { return frame_errors_; }
+  const std::bitset<max_frame_rows>& damaged_rows() const { return damaged_rows_; }
+  // Drops the current frame and ignores all data up to the next FID toggle, e.g. after the stream was interrupted
+  void resync()
+  {
+    discard_frame_ = true;
+    wait_for_fid_toggle_ = true;
+  }
 
 private:
+  std::size_t count_continuation_payloads(std::span<const std::uint8_t> data, std::size_t payload_size) const;
+  bool has_frame() const { return segments_ || !current_frame_.empty(); }
+  void append(const std::uint8_t* data, std::size_t size);
+  void read_scr(const std::uint8_t* header);
+  void mark_damaged(std::size_t begin, std::size_t end);
+
   std::span<std::uint8_t> current_frame_;
+  std::vector<std::span<const std::uint8_t>>* segments_ = nullptr;
+  std::size_t frame_capacity_ = 0;
   std::size_t frame_len_ = 0;
+  std::uint32_t frame_starts_ = 0;
   bool discard_frame_ = false;
+  bool wait_for_fid_toggle_ = false;
   std::uint32_t last_pts_ = 0;
+  std::uint32_t frame_pts_ = 0;
+  std::uint32_t frame_scr_ = 0;
+  std::uint16_t frame_sof_ = 0;
   std::uint8_t last_fid_ = 0;
+  std::chrono::steady_clock::time_point receive_time_;
+  std::chrono::steady_clock::time_point first_payload_time_;
+
+  // Salvage mode
+  std::size_t row_size_ = 0;
+  bool pts_known_ = true;
+  std::uint8_t frame_errors_ = 0;
+  std::bitset<max_frame_rows> damaged_rows_;
 };
 
 PSEYE_NS_END
@@ -15,7 +15,7 @@
 #ifndef PSEYE_HW_OV534_HPP
 #define PSEYE_HW_OV534_HPP
 
-#include "pseye/detail/config.hpp"
+#include "pseye/detail/hardware.hpp"
 
 #if PSEYE_HAS_PRAGMA_ONCE
 #pragma once
@@ -229,6 +229,11 @@ inline constexpr register_setting<reg> start_qvga[] = {
     {  reg::vertical_blocks, 240 / 8},
 };
 
+// UVC payload header in front of each payload: length, flags, PTS & SCR
+inline constexpr std::uint32_t payload_header_size = 12;
+// Payload size (including the header) we configure for bulk streaming, isochronous payloads fill a whole packet
+inline constexpr std::uint32_t bulk_payload_size = 2 * 1024;
+
 enum class video_format
 {
   raw8,
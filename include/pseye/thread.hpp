@@ -0,0 +1,54 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PSEYE_THREAD_HPP
+#define PSEYE_THREAD_HPP
+
+#include "pseye/detail/config.hpp"
+
+#if PSEYE_HAS_PRAGMA_ONCE
+# pragma once
+#endif
+
+#include <string>
+#include <vector>
+
+PSEYE_NS_BEGIN
+
+enum class thread_scheduling
+{
+  normal,
+  fifo,        // SCHED_FIFO on Linux, time-critical priority on Windows
+  round_robin, // SCHED_RR on Linux, time-critical priority on Windows
+};
+
+struct thread_options
+{
+  // Shows up in debuggers and top, Linux truncates it to 15 characters
+  std::string name;
+  thread_scheduling scheduling = thread_scheduling::normal;
+  // Real-time priority for |fifo| and |round_robin| (1-99 on Linux)
+  int priority = 1;
+  // Used for |normal| scheduling and as a fallback if we aren't permitted to use a real-time policy
+  int nice = 0;
+  // CPU indices the thread may run on, empty for any
+  std::vector<unsigned> cpu_affinity;
+};
+
+// Applies |options| to the calling thread. Best effort: failures are logged, not thrown.
+void configure_current_thread(const thread_options& options);
+
+PSEYE_NS_END
+
+#endif
@@ -0,0 +1,151 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/thread.hpp"
+
+#include "pseye/log.hpp"
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <cerrno>
+# include <cstring>
+# include <pthread.h>
+# include <sched.h>
+# include <sys/resource.h>
+# if defined(__linux__)
+#  include <sys/syscall.h>
+#  include <unistd.h>
+# endif
+#endif
+
+PSEYE_NS_BEGIN
+
+#if defined(_WIN32)
+
+namespace
+{
+
+int nice_to_priority(int nice)
+{
+  if (nice <= -10)
+    return THREAD_PRIORITY_HIGHEST;
+  if (nice < 0)
+    return THREAD_PRIORITY_ABOVE_NORMAL;
+  if (nice >= 10)
+    return THREAD_PRIORITY_LOWEST;
+  if (nice > 0)
+    return THREAD_PRIORITY_BELOW_NORMAL;
+  return THREAD_PRIORITY_NORMAL;
+}
+
+} // namespace
+
+void configure_current_thread(const thread_options& options)
+{
+  const auto thread = ::GetCurrentThread();
+
+  if (!options.name.empty()) {
+    std::wstring name(options.name.size(), L'\0');
+    const auto len = ::MultiByteToWideChar(CP_UTF8, 0, options.name.data(), static_cast<int>(options.name.size()),
+                                           name.data(), static_cast<int>(name.size()));
+    name.resize(len);
+    ::SetThreadDescription(thread, name.c_str());
+  }
+
+  // There's no real-time policy to speak of, the closest is the highest priority of the (non-realtime) class
+  const int priority = options.scheduling != thread_scheduling::normal ? THREAD_PRIORITY_TIME_CRITICAL
+                                                                        : nice_to_priority(options.nice);
+  if (!::SetThreadPriority(thread, priority))
+    PSEYE_LOG_WARNING("failed to set thread priority {}: {}", priority, ::GetLastError());
+
+  if (!options.cpu_affinity.empty()) {
+    DWORD_PTR mask = 0;
+    for (const auto cpu : options.cpu_affinity) {
+      if (cpu < sizeof(mask) * 8)
+        mask |= DWORD_PTR{1} << cpu;
+    }
+    if (!::SetThreadAffinityMask(thread, mask))
+      PSEYE_LOG_WARNING("failed to set thread affinity {:#x}: {}", mask, ::GetLastError());
+  }
+}
+
+#else
+
+namespace
+{
+
+void set_nice(int nice)
+{
+# if defined(__linux__)
+  // Linux keeps the nice value per thread
+  const auto tid = static_cast<id_t>(::syscall(SYS_gettid));
+  if (::setpriority(PRIO_PROCESS, tid, nice) != 0)
+    PSEYE_LOG_WARNING("failed to set nice value {}: {}", nice, std::strerror(errno));
+# else
+  PSEYE_LOG_WARNING("per-thread nice values are not supported on this platform");
+# endif
+}
+
+} // namespace
+
+void configure_current_thread(const thread_options& options)
+{
+  const auto thread = ::pthread_self();
+
+  if (!options.name.empty()) {
+# if defined(__APPLE__)
+    ::pthread_setname_np(options.name.c_str());
+# else
+    ::pthread_setname_np(thread, options.name.substr(0, 15).c_str());
+# endif
+  }
+
+  if (options.scheduling != thread_scheduling::normal) {
+    const int policy = options.scheduling == thread_scheduling::fifo ? SCHED_FIFO : SCHED_RR;
+    sched_param param{};
+    param.sched_priority = options.priority;
+    const int ret = ::pthread_setschedparam(thread, policy, &param);
+    if (ret == 0) {
+      PSEYE_LOG_DEBUG("running {} with real-time priority {}", options.name, options.priority);
+    } else {
+      // Usually EPERM without CAP_SYS_NICE or a matching RLIMIT_RTPRIO
+      PSEYE_LOG_WARNING("failed to set real-time priority {}: {}, falling back to nice {}", options.priority,
+                        std::strerror(ret), options.nice);
+      set_nice(options.nice);
+    }
+  } else if (options.nice != 0) {
+    set_nice(options.nice);
+  }
+
+  if (!options.cpu_affinity.empty()) {
+# if defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (const auto cpu : options.cpu_affinity) {
+      if (cpu < CPU_SETSIZE)
+        CPU_SET(cpu, &cpus);
+    }
+    const int ret = ::pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+    if (ret != 0)
+      PSEYE_LOG_WARNING("failed to set thread affinity: {}", std::strerror(ret));
+# else
+    PSEYE_LOG_WARNING("thread affinity is not supported on this platform");
+# endif
+  }
+}
+
+#endif
+
+PSEYE_NS_END
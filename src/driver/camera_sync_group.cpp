@@ -0,0 +1,102 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/camera_sync_group.hpp"
+#include "pseye/driver/simple_pseye_camera.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+PSEYE_NS_BEGIN
+
+camera_sync_group::camera_sync_group(const camera_sync_options& options)
+  : options_(options)
+{
+}
+
+void camera_sync_group::add_camera(simple_pseye_camera& camera)
+{
+  // Their frames live in simple_pseye_camera::segmented_frames(), there's no frame buffer to take them from
+  if (camera.is_zero_copy())
+    throw std::invalid_argument("zero-copy cameras can't be synchronized");
+
+  member m;
+  m.frame_buffer = &camera.frame_buffer();
+  members_.push_back(m);
+}
+
+bool camera_sync_group::fetch(member& m, std::chrono::steady_clock::time_point deadline)
+{
+  if (!m.frame.empty())
+    return true;
+
+  const auto frame = m.frame_buffer->readable_frame_wait_until(deadline);
+  if (frame.empty())
+    return false;
+
+  m.frame = frame;
+  m.metadata = m.frame_buffer->readable_metadata();
+  m.capture_time = m.metadata.capture_time;
+  return true;
+}
+
+void camera_sync_group::discard(member& m)
+{
+  m.frame_buffer->finish_reading();
+  m.frame = {};
+  m.in_bundle = false;
+}
+
+void camera_sync_group::release()
+{
+  for (auto& m : members_) {
+    if (m.in_bundle)
+      discard(m);
+  }
+}
+
+bool camera_sync_group::wait_until(std::chrono::steady_clock::time_point deadline, frame_bundle& bundle)
+{
+  release();
+  if (members_.empty())
+    return false;
+
+  while (true) {
+    for (auto& m : members_) {
+      if (!fetch(m, deadline))
+        return false;
+    }
+
+    const auto [oldest, newest] = std::minmax_element(
+        members_.begin(), members_.end(), [](const member& a, const member& b) { return a.capture_time < b.capture_time; });
+    const bool complete = newest->capture_time - oldest->capture_time <= options_.tolerance;
+    if (!complete && !options_.deliver_unmatched) {
+      // Frames arrive in order, so nothing is ever going to match the oldest one
+      discard(*oldest);
+      ++num_dropped_frames_;
+      continue;
+    }
+
+    bundle.complete = complete;
+    bundle.frames.resize(members_.size());
+    for (std::size_t i = 0; i != members_.size(); ++i) {
+      auto& m = members_[i];
+      m.in_bundle = complete || &m == &*oldest;
+      bundle.frames[i] = m.in_bundle ? synced_frame{m.frame, m.metadata, m.capture_time} : synced_frame{};
+    }
+    return true;
+  }
+}
+
+PSEYE_NS_END
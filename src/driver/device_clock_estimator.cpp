@@ -0,0 +1,115 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/device_clock_estimator.hpp"
+
+#include <algorithm>
+#include <limits>
+
+PSEYE_NS_BEGIN
+
+device_clock_estimator::device_clock_estimator(std::uint32_t frequency, std::size_t window, std::size_t num_blocks)
+  : frequency_(frequency)
+  , samples_(std::max<std::size_t>(window, 1))
+  , block_minima_(std::max<std::size_t>(num_blocks, 2))
+{
+}
+
+void device_clock_estimator::reset()
+{
+  num_samples_ = 0;
+  next_sample_ = 0;
+  num_blocks_ = 0;
+  next_block_ = 0;
+  block_fill_ = 0;
+  slope_ = 1.0;
+  offset_ = 0.0;
+}
+
+std::int64_t device_clock_estimator::unwrap(std::uint32_t device_time) const
+{
+  // Differences are taken modulo 2^32, so this works across wrap-arounds (and for slightly older timestamps)
+  return last_unwrapped_ + static_cast<std::int32_t>(device_time - last_device_time_);
+}
+
+void device_clock_estimator::add(std::uint32_t device_time, std::chrono::steady_clock::time_point host_time)
+{
+  if (num_samples_ == 0) {
+    host_base_ = host_time;
+    last_unwrapped_ = 0;
+  } else {
+    last_unwrapped_ = unwrap(device_time);
+  }
+  last_device_time_ = device_time;
+
+  const sample s{static_cast<double>(last_unwrapped_) / frequency_,
+                 std::chrono::duration<double>(host_time - host_base_).count()};
+  samples_[next_sample_] = s;
+  next_sample_ = (next_sample_ + 1) % samples_.size();
+  num_samples_ = std::min(num_samples_ + 1, samples_.size());
+
+  // Drift is orders of magnitude below the latency jitter, comparing delays within a block needn't account for it
+  if (block_fill_ == 0 || s.host_seconds - s.device_seconds < block_min_.host_seconds - block_min_.device_seconds)
+    block_min_ = s;
+  if (++block_fill_ == samples_.size()) {
+    block_minima_[next_block_] = block_min_;
+    next_block_ = (next_block_ + 1) % block_minima_.size();
+    num_blocks_ = std::min(num_blocks_ + 1, block_minima_.size());
+    block_fill_ = 0;
+    fit_drift();
+  }
+  fit_offset();
+}
+
+void device_clock_estimator::fit_drift()
+{
+  const std::size_t n = num_blocks_;
+  if (n < 2)
+    return;
+
+  double mean_x = 0.0, mean_y = 0.0;
+  for (std::size_t i = 0; i != n; ++i) {
+    mean_x += block_minima_[i].device_seconds;
+    mean_y += block_minima_[i].host_seconds;
+  }
+  mean_x /= n;
+  mean_y /= n;
+
+  double sxx = 0.0, sxy = 0.0;
+  for (std::size_t i = 0; i != n; ++i) {
+    const double dx = block_minima_[i].device_seconds - mean_x;
+    sxx += dx * dx;
+    sxy += dx * (block_minima_[i].host_seconds - mean_y);
+  }
+  // Anything far off is a glitch (e.g. a device reset), not drift
+  const double slope = sxx > 0.0 ? sxy / sxx : 1.0;
+  slope_ = slope > 0.999 && slope < 1.001 ? slope : 1.0;
+}
+
+void device_clock_estimator::fit_offset()
+{
+  double offset = std::numeric_limits<double>::max();
+  for (std::size_t i = 0; i != num_samples_; ++i)
+    offset = std::min(offset, samples_[i].host_seconds - slope_ * samples_[i].device_seconds);
+  offset_ = offset;
+}
+
+std::chrono::steady_clock::time_point device_clock_estimator::to_host(std::uint32_t device_time) const
+{
+  const double device_seconds = static_cast<double>(unwrap(device_time)) / frequency_;
+  return host_base_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                          std::chrono::duration<double>(offset_ + slope_ * device_seconds));
+}
+
+PSEYE_NS_END
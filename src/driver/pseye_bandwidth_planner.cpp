@@ -0,0 +1,132 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/pseye_bandwidth_planner.hpp"
+#include "pseye/hw/ov534.hpp"
+
+#include <algorithm>
+
+PSEYE_NS_BEGIN
+
+std::uint64_t stream_bandwidth(const pseye_stream_config& config)
+{
+  const std::size_t width = config.mode == size_mode::vga ? 640 : 320;
+  const std::size_t height = config.mode == size_mode::vga ? 480 : 240;
+  const std::uint64_t frame_size = size_bytes(config.internal_format, width, height);
+  const std::uint64_t payload_data_size = ov534::bulk_payload_size - ov534::payload_header_size;
+  const auto num_payloads = (frame_size + payload_data_size - 1) / payload_data_size;
+  return num_payloads * ov534::bulk_payload_size * find_valid_frame_rate(config.mode, config.frame_rate);
+}
+
+namespace
+{
+
+// Formats the bridge produces natively, best first
+inline constexpr pixel_format format_ladder[] = {pixel_format::yuyv, pixel_format::uyvy, pixel_format::grbg10,
+                                                 pixel_format::grbg8};
+
+// Configurations a camera may be degraded to, best (the request) first
+std::vector<pseye_stream_config> make_candidates(const pseye_stream_config& requested, int min_frame_rate)
+{
+  std::vector<pseye_stream_config> candidates;
+  const auto add_formats = [&](size_mode mode, int frame_rate) {
+    const auto first = std::find(std::begin(format_ladder), std::end(format_ladder), requested.internal_format);
+    if (first == std::end(format_ladder)) {
+      candidates.push_back({mode, frame_rate, requested.internal_format});
+      return;
+    }
+    for (auto it = first; it != std::end(format_ladder); ++it) {
+      if (*it != pixel_format::uyvy || requested.internal_format == pixel_format::uyvy)
+        candidates.push_back({mode, frame_rate, *it});
+    }
+  };
+
+  add_formats(requested.mode, requested.frame_rate);
+  if (requested.mode == size_mode::vga)
+    add_formats(size_mode::qvga, requested.frame_rate);
+
+  // Last resort: slow down the cheapest configuration
+  const auto cheapest = candidates.back();
+  const int current_rate = find_valid_frame_rate(cheapest.mode, cheapest.frame_rate);
+  for (const int rate : supported_frame_rates(cheapest.mode)) {
+    if (rate < current_rate && rate >= min_frame_rate)
+      candidates.push_back({cheapest.mode, rate, cheapest.internal_format});
+  }
+  return candidates;
+}
+
+} // namespace
+
+pseye_bandwidth_plan plan_bandwidth(std::span<const pseye_bandwidth_request> requests,
+                                    const pseye_bandwidth_limits& limits)
+{
+  pseye_bandwidth_plan plan;
+  plan.cameras.resize(requests.size());
+
+  std::vector<std::vector<pseye_stream_config>> candidates(requests.size());
+  std::vector<std::size_t> levels(requests.size(), 0);
+  for (std::size_t i = 0; i != requests.size(); ++i)
+    candidates[i] = make_candidates(requests[i].config, limits.min_frame_rate);
+
+  std::vector<std::uint8_t> buses;
+  for (const auto& request : requests) {
+    if (std::find(buses.begin(), buses.end(), request.bus_number) == buses.end())
+      buses.push_back(request.bus_number);
+  }
+
+  for (const std::uint8_t bus : buses) {
+    while (true) {
+      std::uint64_t total = 0;
+      std::size_t most_expensive = requests.size();
+      std::uint64_t most_expensive_bandwidth = 0;
+      for (std::size_t i = 0; i != requests.size(); ++i) {
+        if (requests[i].bus_number != bus)
+          continue;
+
+        const auto bandwidth = stream_bandwidth(candidates[i][levels[i]]);
+        total += bandwidth;
+        if (levels[i] + 1 < candidates[i].size() && bandwidth > most_expensive_bandwidth) {
+          most_expensive = i;
+          most_expensive_bandwidth = bandwidth;
+        }
+      }
+
+      if (total <= limits.bytes_per_second_per_bus)
+        break;
+      if (most_expensive == requests.size()) {
+        plan.feasible = false;
+        break;
+      }
+
+      // Skip levels that don't actually save anything (e.g. a frame rate QVGA maps to the same value)
+      const auto& camera_candidates = candidates[most_expensive];
+      auto& level = levels[most_expensive];
+      do {
+        ++level;
+      } while (level + 1 < camera_candidates.size() &&
+               stream_bandwidth(camera_candidates[level]) >= most_expensive_bandwidth);
+    }
+  }
+
+  for (std::size_t i = 0; i != requests.size(); ++i) {
+    auto& entry = plan.cameras[i];
+    entry.config = candidates[i][levels[i]];
+    entry.config.frame_rate = find_valid_frame_rate(entry.config.mode, entry.config.frame_rate);
+    entry.bytes_per_second = stream_bandwidth(entry.config);
+    entry.degraded = levels[i] != 0;
+  }
+  return plan;
+}
+
+PSEYE_NS_END
@@ -0,0 +1,98 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/pseye_camera_startup.hpp"
+#include "pseye/driver/pseye_topology_cache.hpp"
+#include "pseye/exception.hpp"
+#include "pseye/log.hpp"
+
+#include <thread>
+
+PSEYE_NS_BEGIN
+
+static void start_pseye_camera(usb_context& context,
+                               pseye_topology_cache* topology,
+                               const pseye_camera_request& request,
+                               pseye_camera_startup& result,
+                               pseye_startup_progress_handler progress,
+                               void* progress_ctx,
+                               std::size_t index)
+{
+  const auto report = [&](pseye_startup_stage stage) {
+    if (progress)
+      progress(progress_ctx, index, stage);
+  };
+
+  try {
+    report(pseye_startup_stage::opening);
+    pseye_endpoints endpoints;
+    const auto handle = topology ? topology->open(request.device.bus_number, request.device.port_path, &endpoints)
+                                 : open_pseye_device(context, request.device);
+    if (!handle)
+      throw std::runtime_error("no camera at " + request.device.location());
+
+    // Most of the time goes here: sensor reset and register programming are all blocking control transfers
+    report(pseye_startup_stage::initializing);
+    auto camera = std::make_unique<simple_pseye_camera>(handle, endpoints, request.initial_state);
+
+    report(pseye_startup_stage::starting);
+    camera->start(request.mode, request.frame_rate, request.internal_format, request.options);
+
+    result.camera = std::move(camera);
+    report(pseye_startup_stage::streaming);
+  } catch (const std::exception& e) {
+    PSEYE_LOG_ERROR("failed to start camera at {}: {}", request.device.location(), e.what());
+    result.error = std::current_exception();
+    report(pseye_startup_stage::failed);
+  }
+}
+
+static std::vector<pseye_camera_startup> start_pseye_cameras(usb_context& context,
+                                                             pseye_topology_cache* topology,
+                                                             std::span<const pseye_camera_request> requests,
+                                                             pseye_startup_progress_handler progress,
+                                                             void* progress_ctx)
+{
+  std::vector<pseye_camera_startup> results(requests.size());
+
+  // Control transfers of different devices don't contend with each other, so one thread per camera it is
+  std::vector<std::thread> threads;
+  threads.reserve(requests.size());
+  for (std::size_t i = 0; i != requests.size(); ++i) {
+    threads.emplace_back(start_pseye_camera, std::ref(context), topology, std::cref(requests[i]),
+                         std::ref(results[i]), progress, progress_ctx, i);
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  return results;
+}
+
+std::vector<pseye_camera_startup> start_pseye_cameras(usb_context& context,
+                                                      std::span<const pseye_camera_request> requests,
+                                                      pseye_startup_progress_handler progress,
+                                                      void* progress_ctx)
+{
+  return start_pseye_cameras(context, nullptr, requests, progress, progress_ctx);
+}
+
+std::vector<pseye_camera_startup> start_pseye_cameras(pseye_topology_cache& topology,
+                                                      std::span<const pseye_camera_request> requests,
+                                                      pseye_startup_progress_handler progress,
+                                                      void* progress_ctx)
+{
+  return start_pseye_cameras(topology.context(), &topology, requests, progress, progress_ctx);
+}
+
+PSEYE_NS_END
@@ -38,6 +38,13 @@ pseye_device_controller::pseye_device_controller(libusb_device* device, std::uin
 }
 
 pseye_device_controller::pseye_device_controller(libusb_device_handle* h, std::uint8_t interface_index)
+  : pseye_device_controller(h, interface_index, {})
+{
+}
+
+pseye_device_controller::pseye_device_controller(libusb_device_handle* h,
+                                                 std::uint8_t interface_index,
+                                                 const pseye_endpoints& endpoints)
   : interface_index_(interface_index)
 {
   // tell libusb to detach any active kernel drivers.
@@ -60,23 +67,36 @@ pseye_device_controller::pseye_device_controller(libusb_device_handle* h, std::u
   device_handle_.reset(h);
   device_handle_.get_deleter().interface_index = interface_index;
 
+  const auto found = endpoints.bulk != 0 ? endpoints : find_pseye_endpoints(::libusb_get_device(h), interface_index);
+  bulk_endpoint_ = found.bulk;
+  iso_endpoint_ = found.iso;
+  iso_alternate_setting_ = found.iso_alternate_setting;
+}
+
+pseye_endpoints find_pseye_endpoints(libusb_device* device, std::uint8_t interface_index)
+{
   libusb_config_descriptor* config = nullptr;
-  ret = ::libusb_get_active_config_descriptor(::libusb_get_device(h), &config);
-  if (ret == LIBUSB_SUCCESS) {
-    const auto bulk_endpoint = find_endpoint(config, interface_index, LIBUSB_TRANSFER_TYPE_BULK);
-    const auto iso_endpoint = find_endpoint(config, interface_index, LIBUSB_TRANSFER_TYPE_ISOCHRONOUS);
-    PSEYE_LOG_DEBUG("active endpoints: iso {} bulk {}", !iso_endpoint ? -1 : iso_endpoint->bEndpointAddress,
-                    !bulk_endpoint ? -1 : bulk_endpoint->bEndpointAddress);
-    if (!bulk_endpoint) {
-      ::libusb_free_config_descriptor(config);
-      throw usb_error(ret, "failed to find required bulk endpoint");
-    }
-    bulk_endpoint_ = bulk_endpoint->bEndpointAddress;
-    ::libusb_free_config_descriptor(config);
-  } else {
+  const auto ret = ::libusb_get_active_config_descriptor(device, &config);
+  if (ret != LIBUSB_SUCCESS) {
     PSEYE_LOG_ERROR("failed to query active config: {} {}", ret, ::libusb_error_name(ret));
     throw usb_error(ret, "failed to query active config");
   }
+
+  pseye_endpoints endpoints;
+  const auto bulk_endpoint = find_endpoint(config, interface_index, LIBUSB_TRANSFER_TYPE_BULK);
+  const auto iso_endpoint =
+      find_endpoint(config, interface_index, LIBUSB_TRANSFER_TYPE_ISOCHRONOUS, &endpoints.iso_alternate_setting);
+  PSEYE_LOG_DEBUG("active endpoints: iso {} bulk {}", !iso_endpoint ? -1 : iso_endpoint->bEndpointAddress,
+                  !bulk_endpoint ? -1 : bulk_endpoint->bEndpointAddress);
+  if (!bulk_endpoint) {
+    ::libusb_free_config_descriptor(config);
+    throw usb_error(ret, "failed to find required bulk endpoint");
+  }
+  endpoints.bulk = bulk_endpoint->bEndpointAddress;
+  if (iso_endpoint)
+    endpoints.iso = iso_endpoint->bEndpointAddress;
+  ::libusb_free_config_descriptor(config);
+  return endpoints;
 }
 
 void pseye_device_controller::free_device::operator()(libusb_device_handle* h) const
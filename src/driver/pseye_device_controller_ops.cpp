@@ -106,6 +106,14 @@ bool check_sccb_status(pseye_device_controller& controller)
   return false;
 }
 
+std::uint16_t read_sensor_id(pseye_device_controller& controller)
+{
+  write_register(controller, ov534::reg::ms_id, 0x42);
+  std::uint16_t product_id = read_sccb_register(controller, ov7725::reg::pid) << 8;
+  product_id |= read_sccb_register(controller, ov7725::reg::ver);
+  return product_id;
+}
+
 void write_video_data(pseye_device_controller& controller, const void* data, int len, std::uint8_t offset)
 {
   write_register(controller, ov534::reg::video_data_addr, offset);
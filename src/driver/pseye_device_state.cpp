@@ -101,6 +101,17 @@ int find_valid_frame_rate(size_mode mode, int desired_fps)
   throw std::runtime_error("invalid mode");
 }
 
+std::vector<int> supported_frame_rates(size_mode mode)
+{
+  const auto rates = mode == size_mode::vga ? std::span<const detail::pseye_frame_rate_info>(detail::supported_rates_vga)
+                                            : std::span<const detail::pseye_frame_rate_info>(detail::supported_rates_qvga);
+  std::vector<int> fps;
+  fps.reserve(rates.size());
+  for (const auto& info : rates)
+    fps.push_back(info.fps);
+  return fps;
+}
+
 void set_frame_rate(pseye_device_controller& controller, size_mode mode, int desired_fps)
 {
   const detail::pseye_frame_rate_info& info = mode == size_mode::vga
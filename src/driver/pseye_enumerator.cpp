@@ -0,0 +1,182 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/pseye_enumerator.hpp"
+#include "pseye/driver/pseye_device_controller.hpp"
+#include "pseye/driver/pseye_device_controller_ops.hpp"
+#include "pseye/driver/pseye_topology_cache.hpp"
+#include "pseye/driver/usb_context.hpp"
+#include "pseye/exception.hpp"
+#include "pseye/log.hpp"
+
+#include <libusb.h>
+
+#include <algorithm>
+#include <charconv>
+#include <iterator>
+
+PSEYE_NS_BEGIN
+
+namespace
+{
+
+bool is_pseye(const libusb_device_descriptor& desc)
+{
+  return desc.idVendor == pseye_vendor_id && desc.idProduct == pseye_product_id;
+}
+
+std::vector<std::uint8_t> get_port_path(libusb_device* device)
+{
+  std::uint8_t ports[7]; // USB 3.0 allows for up to 7 tiers
+  const auto num_ports = ::libusb_get_port_numbers(device, ports, static_cast<int>(std::size(ports)));
+  if (num_ports < 0) {
+    PSEYE_LOG_WARNING("failed to query port path: {} {}", num_ports, ::libusb_error_name(num_ports));
+    return {};
+  }
+  return {ports, ports + num_ports};
+}
+
+} // namespace
+
+std::string pseye_device_info::location() const
+{
+  auto location = std::to_string(bus_number);
+  for (std::size_t i = 0; i < port_path.size(); ++i) {
+    location += i == 0 ? '-' : '.';
+    location += std::to_string(port_path[i]);
+  }
+  return location;
+}
+
+bool parse_device_location(std::string_view location, std::uint8_t& bus_number, std::vector<std::uint8_t>& port_path)
+{
+  const auto end = location.data() + location.size();
+  auto [ptr, ec] = std::from_chars(location.data(), end, bus_number);
+  if (ec != std::errc() || ptr == end || *ptr != '-')
+    return false;
+
+  port_path.clear();
+  while (ptr != end) {
+    // '-' in front of the first port, '.' in front of any other
+    if (*ptr != (port_path.empty() ? '-' : '.'))
+      return false;
+
+    std::uint8_t port;
+    const auto res = std::from_chars(ptr + 1, end, port);
+    if (res.ec != std::errc())
+      return false;
+    port_path.push_back(port);
+    ptr = res.ptr;
+  }
+  return true;
+}
+
+pseye_device_info get_device_info(libusb_device* device)
+{
+  pseye_device_info info;
+  info.bus_number = ::libusb_get_bus_number(device);
+  info.device_address = ::libusb_get_device_address(device);
+  info.port_path = get_port_path(device);
+  return info;
+}
+
+std::uint16_t query_pseye_sensor_id(libusb_device* device)
+{
+  libusb_device_handle* h = nullptr;
+  const auto ret = ::libusb_open(device, &h);
+  if (ret != LIBUSB_SUCCESS) {
+    PSEYE_LOG_WARNING("failed to open device to query sensor ID: {} {}", ret, ::libusb_error_name(ret));
+    return 0;
+  }
+
+  // Don't take the camera away from a kernel driver (e.g. gspca_ov534) just to look at it
+  if (::libusb_kernel_driver_active(h, pseye_interface_number) == 1) {
+    PSEYE_LOG_DEBUG("not querying sensor ID, interface {} is bound to a kernel driver", pseye_interface_number);
+    ::libusb_close(h);
+    return 0;
+  }
+
+  try {
+    pseye_device_controller controller(h, pseye_interface_number);
+    return read_sensor_id(controller);
+  } catch (const usb_error& e) {
+    // Most likely someone else is streaming from it
+    PSEYE_LOG_WARNING("failed to query sensor ID: {}", e.what());
+    return 0;
+  }
+}
+
+std::vector<pseye_device_info> enumerate_pseye_devices(usb_context& context, bool query_sensor)
+{
+  std::vector<pseye_device_info> devices;
+  if (const auto cache = context.topology_cache()) {
+    // Already ordered, sensor IDs are there if the cache queries them
+    for (auto& entry : cache->snapshot())
+      devices.push_back(std::move(entry.info));
+    return devices;
+  }
+
+  context.for_each_device([&](libusb_device* dev, const libusb_device_descriptor& desc) {
+    if (!is_pseye(desc))
+      return;
+
+    auto info = get_device_info(dev);
+    if (query_sensor)
+      info.sensor_id = query_pseye_sensor_id(dev);
+    PSEYE_LOG_DEBUG("found camera at {} (address {}, sensor OV{:04x})", info.location(), info.device_address,
+                    info.sensor_id);
+    devices.push_back(std::move(info));
+  });
+
+  // Enumeration order is up to the OS, make it stable
+  std::sort(devices.begin(), devices.end(), [](const pseye_device_info& a, const pseye_device_info& b) {
+    if (a.bus_number != b.bus_number)
+      return a.bus_number < b.bus_number;
+    return a.port_path < b.port_path;
+  });
+  return devices;
+}
+
+libusb_device_handle* open_pseye_device(usb_context& context,
+                                        std::uint8_t bus_number,
+                                        std::span<const std::uint8_t> port_path)
+{
+  if (const auto cache = context.topology_cache())
+    return cache->open(bus_number, port_path);
+
+  // Assigned once, so retrying doesn't move the camera (or everyone after it) to another event loop
+  const auto event_loop = context.assign_event_loop(bus_number, port_path);
+  libusb_device_handle* handle = nullptr;
+  int ret = LIBUSB_SUCCESS;
+  context.for_each_device(
+      [&](libusb_device* dev, const libusb_device_descriptor& desc) {
+        if (handle || ret != LIBUSB_SUCCESS || !is_pseye(desc) || ::libusb_get_bus_number(dev) != bus_number)
+          return;
+
+        const auto path = get_port_path(dev);
+        if (!std::equal(path.begin(), path.end(), port_path.begin(), port_path.end()))
+          return;
+
+        ret = ::libusb_open(dev, &handle);
+      },
+      event_loop);
+
+  if (ret != LIBUSB_SUCCESS) {
+    PSEYE_LOG_ERROR("failed to open device: {} {}", ret, ::libusb_error_name(ret));
+    throw usb_error(ret, "failed to open USB device");
+  }
+  return handle;
+}
+
+PSEYE_NS_END
@@ -0,0 +1,199 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/pseye_topology_cache.hpp"
+#include "pseye/exception.hpp"
+#include "pseye/log.hpp"
+
+#include <libusb.h>
+
+#include <algorithm>
+
+PSEYE_NS_BEGIN
+
+pseye_topology_cache::pseye_topology_cache(usb_context& context, bool query_sensor)
+  : context_(context)
+  , query_sensor_(query_sensor)
+{
+  hotplug_id_ = context_.add_hotplug_handler(pseye_vendor_id, pseye_product_id, &pseye_topology_cache::on_hotplug, this);
+}
+
+pseye_topology_cache::~pseye_topology_cache()
+{
+  if (context_.topology_cache() == this)
+    context_.set_topology_cache(nullptr);
+  if (hotplug_id_ != 0)
+    context_.remove_hotplug_handler(hotplug_id_);
+  release(devices_);
+}
+
+void pseye_topology_cache::on_hotplug(void* ctx, usb_hotplug_event, libusb_device*)
+{
+  // No sync I/O allowed on the event thread, rescan lazily
+  static_cast<pseye_topology_cache*>(ctx)->stale_.store(true, std::memory_order_release);
+}
+
+void pseye_topology_cache::release(std::vector<cached_device>& devices)
+{
+  for (const auto& device : devices) {
+    for (libusb_device* dev : device.devices) {
+      if (dev)
+        ::libusb_unref_device(dev);
+    }
+  }
+  devices.clear();
+}
+
+void pseye_topology_cache::refresh_locked()
+{
+  // Events arriving while we scan make us scan again next time
+  stale_.store(false, std::memory_order_release);
+
+  std::vector<cached_device> devices;
+  for (std::size_t loop = 0; loop != context_.num_event_loops(); ++loop) {
+    context_.for_each_device(
+        [&](libusb_device* dev, const libusb_device_descriptor& desc) {
+          if (desc.idVendor != pseye_vendor_id || desc.idProduct != pseye_product_id)
+            return;
+
+          auto info = get_device_info(dev);
+          auto it = std::find_if(devices.begin(), devices.end(), [&](const cached_device& device) {
+            return device.entry.info.bus_number == info.bus_number && device.entry.info.port_path == info.port_path;
+          });
+          if (it == devices.end()) {
+            cached_device device;
+            device.entry.info = std::move(info);
+            device.devices.resize(context_.num_event_loops());
+            devices.push_back(std::move(device));
+            it = devices.end() - 1;
+          }
+          if (!it->devices[loop])
+            it->devices[loop] = ::libusb_ref_device(dev);
+        },
+        loop);
+  }
+
+  for (auto& device : devices) {
+    libusb_device* dev = device.devices.front();
+    if (!dev)
+      continue; // appeared between scanning the event loops
+
+    // Same port & address: it's still the same device, no need to ask it again
+    const auto* previous = find_locked(device.entry.info.bus_number, device.entry.info.port_path);
+    if (previous && previous->entry.info.device_address == device.entry.info.device_address) {
+      device.entry.endpoints = previous->entry.endpoints;
+      device.entry.info.sensor_id = previous->entry.info.sensor_id;
+      continue;
+    }
+
+    try {
+      device.entry.endpoints = find_pseye_endpoints(dev, pseye_interface_number);
+    } catch (const usb_error& e) {
+      PSEYE_LOG_WARNING("failed to query endpoints of camera at {}: {}", device.entry.info.location(), e.what());
+    }
+    if (query_sensor_)
+      device.entry.info.sensor_id = query_pseye_sensor_id(dev);
+  }
+
+  std::sort(devices.begin(), devices.end(), [](const cached_device& a, const cached_device& b) {
+    if (a.entry.info.bus_number != b.entry.info.bus_number)
+      return a.entry.info.bus_number < b.entry.info.bus_number;
+    return a.entry.info.port_path < b.entry.info.port_path;
+  });
+
+  release(devices_);
+  devices_ = std::move(devices);
+  PSEYE_LOG_DEBUG("topology cache holds {} cameras", devices_.size());
+}
+
+pseye_topology_cache::cached_device* pseye_topology_cache::find_locked(std::uint8_t bus_number,
+                                                                        std::span<const std::uint8_t> port_path)
+{
+  const auto it = std::find_if(devices_.begin(), devices_.end(), [&](const cached_device& device) {
+    return device.entry.info.bus_number == bus_number &&
+           std::equal(device.entry.info.port_path.begin(), device.entry.info.port_path.end(), port_path.begin(),
+                      port_path.end());
+  });
+  return it != devices_.end() ? &*it : nullptr;
+}
+
+void pseye_topology_cache::refresh()
+{
+  std::lock_guard lock(mutex_);
+  refresh_locked();
+}
+
+std::vector<pseye_topology_entry> pseye_topology_cache::snapshot()
+{
+  std::lock_guard lock(mutex_);
+  if (stale_.load(std::memory_order_acquire))
+    refresh_locked();
+
+  std::vector<pseye_topology_entry> entries;
+  entries.reserve(devices_.size());
+  for (const auto& device : devices_)
+    entries.push_back(device.entry);
+  return entries;
+}
+
+bool pseye_topology_cache::find(std::uint8_t bus_number,
+                                std::span<const std::uint8_t> port_path,
+                                pseye_topology_entry& entry)
+{
+  std::lock_guard lock(mutex_);
+  if (stale_.load(std::memory_order_acquire))
+    refresh_locked();
+
+  const auto device = find_locked(bus_number, port_path);
+  if (!device)
+    return false;
+  entry = device->entry;
+  return true;
+}
+
+libusb_device_handle* pseye_topology_cache::open(std::uint8_t bus_number,
+                                                 std::span<const std::uint8_t> port_path,
+                                                 pseye_endpoints* endpoints)
+{
+  std::lock_guard lock(mutex_);
+  if (stale_.load(std::memory_order_acquire))
+    refresh_locked();
+
+  auto device = find_locked(bus_number, port_path);
+  if (!device && hotplug_id_ == 0) {
+    refresh_locked();
+    device = find_locked(bus_number, port_path);
+  }
+  if (!device)
+    return nullptr;
+
+  libusb_device* dev = device->devices[context_.assign_event_loop(bus_number, port_path)];
+  if (!dev)
+    return nullptr;
+
+  libusb_device_handle* handle = nullptr;
+  const auto ret = ::libusb_open(dev, &handle);
+  if (ret != LIBUSB_SUCCESS) {
+    PSEYE_LOG_ERROR("failed to open device: {} {}", ret, ::libusb_error_name(ret));
+    // The device might've been replaced without us noticing
+    stale_.store(true, std::memory_order_release);
+    throw usb_error(ret, "failed to open USB device");
+  }
+
+  if (endpoints)
+    *endpoints = device->entry.endpoints;
+  return handle;
+}
+
+PSEYE_NS_END
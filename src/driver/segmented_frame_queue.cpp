@@ -0,0 +1,136 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/segmented_frame_queue.hpp"
+
+#include <cstring>
+
+PSEYE_NS_BEGIN
+
+void pinned_buffer_pool::reset(std::size_t capacity, release_handler handler, void* ctx)
+{
+  std::lock_guard lock(mutex_);
+  ++generation_;
+  slots_.assign(capacity, {});
+  handler_ = handler;
+  handler_ctx_ = ctx;
+}
+
+void pinned_buffer_pool::detach()
+{
+  std::lock_guard lock(mutex_);
+  ++generation_;
+  slots_.clear();
+  handler_ = nullptr;
+}
+
+bool pinned_buffer_pool::pin(std::uint8_t* buffer, buffer_pin& pin)
+{
+  std::lock_guard lock(mutex_);
+  for (std::size_t i = 0; i != slots_.size(); ++i) {
+    if (slots_[i].refs == 0) {
+      slots_[i] = {buffer, 1};
+      pin = {static_cast<std::uint32_t>(i), generation_};
+      return true;
+    }
+  }
+
+  // Can't happen with enough capacity, give it back right away so the transport doesn't run dry
+  if (handler_)
+    handler_(handler_ctx_, buffer);
+  return false;
+}
+
+void pinned_buffer_pool::ref(const buffer_pin& pin)
+{
+  std::lock_guard lock(mutex_);
+  if (pin.generation == generation_)
+    ++slots_[pin.slot].refs;
+}
+
+void pinned_buffer_pool::unref(const buffer_pin& pin)
+{
+  std::lock_guard lock(mutex_);
+  if (pin.generation != generation_)
+    return;
+
+  // Releasing under our lock keeps the transport's single-releaser requirement
+  auto& slot = slots_[pin.slot];
+  if (--slot.refs == 0 && handler_)
+    handler_(handler_ctx_, slot.buffer);
+}
+
+void segmented_frame::copy_to(std::span<std::uint8_t> out) const
+{
+  std::size_t offset = 0;
+  for (const auto& segment : segments) {
+    std::memcpy(out.data() + offset, segment.data(), segment.size());
+    offset += segment.size();
+  }
+}
+
+segmented_frame_queue::segmented_frame_queue(std::uint32_t num_frames, pinned_buffer_pool& pool)
+  : pool_(pool)
+  , frames_(new segmented_frame[num_frames])
+  , num_frames_(num_frames)
+{
+}
+
+void segmented_frame_queue::unpin(segmented_frame& frame)
+{
+  for (const auto& pin : frame.pins)
+    pool_.unref(pin);
+  frame.pins.clear();
+  frame.segments.clear();
+  frame.size = 0;
+}
+
+bool segmented_frame_queue::finish_writing()
+{
+  std::lock_guard lock(mutex_);
+  if (used_ == num_frames_ - 1)
+    return false;
+
+  ++used_;
+  head_ = (head_ + 1) % num_frames_;
+  new_frame_condition_.notify_one();
+  return true;
+}
+
+void segmented_frame_queue::discard_writable_frame()
+{
+  unpin(frames_[head_]);
+}
+
+void segmented_frame_queue::finish_reading()
+{
+  std::lock_guard lock(mutex_);
+  // clear() got to it first
+  if (used_ == 0)
+    return;
+
+  unpin(frames_[tail_]);
+  used_--;
+  tail_ = (tail_ + 1) % num_frames_;
+}
+
+void segmented_frame_queue::clear()
+{
+  std::lock_guard lock(mutex_);
+  for (std::uint32_t i = 0; i != num_frames_; ++i)
+    unpin(frames_[i]);
+  head_ = tail_ = used_ = 0;
+}
+
+PSEYE_NS_END
@@ -13,9 +13,10 @@
 /// You should have received a copy of the GNU General Public License
 /// along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "pseye/driver/simple_pseye_camera.hpp"
-#include "pseye/driver/pseye_device_controller_ops.hpp"
-#include "pseye/driver/usb_transfer_controller.hpp"
-#include "pseye/driver/uvc_frame_processor.hpp"
+#include "pseye/driver/pseye_enumerator.hpp"
+#include "pseye/driver/pseye_topology_cache.hpp"
+#include "pseye/driver/usb_camera_transport.hpp"
+#include "pseye/driver/usb_stream_recording.hpp"
 #include "pseye/driver/spsc_frame_buffer.hpp"
 #include "pseye/exception.hpp"
 #include "pseye/log.hpp"
@@ -27,51 +28,45 @@
 
 PSEYE_NS_BEGIN
 
-namespace
+simple_pseye_camera::simple_pseye_camera(libusb_device* device, const pseye_device_state& initial_state)
+  : simple_pseye_camera(std::make_unique<usb_camera_transport>(device), initial_state)
 {
+  usb_transport_ = static_cast<usb_camera_transport*>(transport_.get());
+}
 
-template <typename Register, std::size_t N>
-void verify_register_sequence(const register_setting<Register> (&a)[N], const register_setting<Register> (&b)[N])
+simple_pseye_camera::simple_pseye_camera(libusb_device_handle* device, const pseye_device_state& initial_state)
+  : simple_pseye_camera(std::make_unique<usb_camera_transport>(device), initial_state)
 {
-  for (std::size_t i = 0; i < N; ++i) {
-    if (a[i].reg != b[i].reg || a[i].value != b[i].value)
-      PSEYE_LOG_ERROR("mismatch {}: {} {} != {} {}", i, static_cast<int>(a[i].reg), a[i].value,
-                      static_cast<int>(b[i].reg), b[i].value);
-  }
+  usb_transport_ = static_cast<usb_camera_transport*>(transport_.get());
 }
 
-} // namespace
-
-inline constexpr std::size_t transfer_count = 5;
-inline constexpr std::size_t transfer_size = 0x10000;
-
-simple_pseye_camera::simple_pseye_camera(libusb_device* device, const pseye_device_state& initial_state)
-  : handle_(device, pseye_interface_number)
-  , state_(initial_state)
-  , transfer_([this](std::span<std::uint8_t> data) {
-    process_transfer_data(data);
-  })
+simple_pseye_camera::simple_pseye_camera(libusb_device_handle* device,
+                                         const pseye_endpoints& endpoints,
+                                         const pseye_device_state& initial_state)
+  : simple_pseye_camera(std::make_unique<usb_camera_transport>(device, endpoints), initial_state)
 {
-  initialize();
+  usb_transport_ = static_cast<usb_camera_transport*>(transport_.get());
 }
 
-simple_pseye_camera::simple_pseye_camera(libusb_device_handle* device, const pseye_device_state& initial_state)
-  : handle_(device, pseye_interface_number)
-  , state_(initial_state)
-  , transfer_([this](std::span<std::uint8_t> data) {
-    process_transfer_data(data);
-  })
+simple_pseye_camera::simple_pseye_camera(std::unique_ptr<camera_transport> transport,
+                                         const pseye_device_state& initial_state)
+  : state_(initial_state)
 {
-  initialize();
+  attach_transport(std::move(transport));
 }
 
 simple_pseye_camera::~simple_pseye_camera()
 {
+  disable_reconnect();
   stop();
 }
 
-void simple_pseye_camera::start(size_mode mode, int frame_rate, pixel_format internal_format)
+void simple_pseye_camera::start(size_mode mode,
+                                int frame_rate,
+                                pixel_format internal_format,
+                                const usb_stream_options& options)
 {
+  std::lock_guard lock(stream_mutex_);
   switch (mode) {
     case size_mode::vga:
       state_.width = 640;
@@ -84,139 +79,456 @@ void simple_pseye_camera::start(size_mode mode, int frame_rate, pixel_format int
   }
   state_.rate = find_valid_frame_rate(mode, frame_rate);
   state_.format = internal_format;
+  options_ = options;
+
+  start_stream();
+  is_active_ = true;
+
+  if (options_.idle_timeout.count() != 0) {
+    idle_exit_requested_ = false;
+    resume_requested_ = false;
+    idle_thread_ = std::thread(&simple_pseye_camera::run_idle_monitor, this);
+  }
+}
+
+void simple_pseye_camera::stop()
+{
+  // The monitor needs |stream_mutex_| itself
+  stop_idle_monitor();
+
+  std::lock_guard lock(stream_mutex_);
+  if (!is_active_)
+    return;
+
+  // Even if stopping fails, there's nothing left to stop afterwards
+  is_active_ = false;
+  stop_stream();
+}
+
+void simple_pseye_camera::enable_reconnect(usb_context& context, const usb_reconnect_policy& policy)
+{
+  if (!usb_transport_)
+    throw std::runtime_error("reconnecting requires a USB camera");
+
+  disable_reconnect();
+
+  const auto info = get_device_info(::libusb_get_device(usb_transport_->device().get()));
+  reconnect_context_ = &context;
+  reconnect_bus_number_ = info.bus_number;
+  reconnect_port_path_ = info.port_path;
+
+  // Without hotplug events we just poll every |retry_interval|
+  hotplug_id_ = context.add_hotplug_handler(
+      pseye_vendor_id, pseye_product_id,
+      [](void* ctx, usb_hotplug_event event, libusb_device* device) {
+        static_cast<simple_pseye_camera*>(ctx)->on_hotplug(event, device);
+      },
+      this);
+  start_reconnect(policy);
+  PSEYE_LOG_DEBUG("reconnecting camera at {} if it gets lost", info.location());
+}
+
+void simple_pseye_camera::enable_reconnect(const usb_reconnect_policy& policy)
+{
+  if (!policy.reopen)
+    throw std::invalid_argument("reconnecting without a USB context requires a reopen handler");
+
+  disable_reconnect();
+
+  reconnect_context_ = nullptr;
+  reconnect_bus_number_ = 0;
+  reconnect_port_path_.clear();
+  start_reconnect(policy);
+}
+
+void simple_pseye_camera::start_reconnect(const usb_reconnect_policy& policy)
+{
+  reconnect_policy_ = policy;
+  device_lost_ = false;
+  device_arrived_ = false;
+  reconnect_exit_requested_ = false;
+  reconnect_thread_ = std::thread(&simple_pseye_camera::run_reconnect, this);
+}
 
+void simple_pseye_camera::disable_reconnect()
+{
+  if (!reconnect_thread_.joinable())
+    return;
+
+  if (hotplug_id_ != 0)
+    reconnect_context_->remove_hotplug_handler(hotplug_id_);
+  hotplug_id_ = 0;
+
+  {
+    std::lock_guard lock(signal_mutex_);
+    reconnect_exit_requested_ = true;
+  }
+  signal_condition_.notify_all();
+  reconnect_thread_.join();
+}
+
+void simple_pseye_camera::attach_transport(std::unique_ptr<camera_transport> transport)
+{
+  transport_ = std::move(transport);
+  transport_->set_handler(
+      [](void* ctx, std::span<std::uint8_t> data) {
+        static_cast<simple_pseye_camera*>(ctx)->on_transfer_data(data);
+      },
+      this);
+  transport_->set_recovery_handler(
+      [](void* ctx, const usb_recovery_info& info) { static_cast<simple_pseye_camera*>(ctx)->on_recovery(info); },
+      this);
+}
+
+void simple_pseye_camera::start_stream()
+{
+  const auto layout = transport_->configure(state_, options_);
+
+  zero_copy_ = options_.zero_copy && layout.buffer_handoff;
+  if (options_.zero_copy && !zero_copy_)
+    PSEYE_LOG_WARNING("zero-copy mode requires a pipelined bulk stream, copying frames instead");
+  if (zero_copy_ && slice_handler_)
+    PSEYE_LOG_WARNING("frame slices aren't available in zero-copy mode");
+
+  // Keep the frame buffer across reconnects, our consumer holds on to it
   const std::uint32_t frame_size = size_bytes(state_.format, state_.width, state_.height);
-  const std::uint32_t payload_size = 2 * 1024;
-
-  ov534::video_data_configuration video_cfg;
-  std::uint8_t com7_value = 0;
-  std::uint8_t dsp_ctrl4_value = 0;
-
-  switch (state_.format) {
-    case pixel_format::grbg8:
-      state_.flip_v = true;
-      video_cfg = ov534::make_video_data_settings(ov534::video_format::raw8, ov534::transfer::bulk, payload_size / 4,
-                                                  frame_size / 4);
-      com7_value |= ov7725::com7_ofmt_processed_bayer;
-      dsp_ctrl4_value |= ov7725::dsp_ctrl4_output_raw8;
-      write_register(handle_, ov534::start_bayer);
-      break;
-    case pixel_format::grbg10:
-      state_.flip_v = true;
-      video_cfg = ov534::make_video_data_settings(ov534::video_format::raw10, ov534::transfer::bulk, payload_size / 4,
-                                                  frame_size / 4);
-      com7_value |= ov7725::com7_ofmt_processed_bayer;
-      dsp_ctrl4_value |= ov7725::dsp_ctrl4_output_raw10;
-      write_register(handle_, ov534::start_bayer);
-      break;
-    case pixel_format::yuyv:
-      video_cfg = ov534::make_video_data_settings(ov534::video_format::yuv422, ov534::transfer::bulk, payload_size / 4,
-                                                  frame_size / 4, false, true);
-      com7_value |= ov7725::com7_ofmt_yuv;
-      dsp_ctrl4_value |= ov7725::dsp_ctrl4_output_yuv;
-      write_register(handle_, ov534::start_yuv);
-      break;
-    case pixel_format::uyvy:
-      video_cfg = ov534::make_video_data_settings(ov534::video_format::yuv422, ov534::transfer::bulk, payload_size / 4,
-                                                  frame_size / 4, false, false);
-      com7_value |= ov7725::com7_ofmt_yuv;
-      dsp_ctrl4_value |= ov7725::dsp_ctrl4_output_yuv;
-      write_register(handle_, ov534::start_yuv);
-      break;
-    default: throw std::runtime_error("unsupported transfer pixel format");
+  const auto on_read = [](void* ctx) { static_cast<simple_pseye_camera*>(ctx)->on_frame_read(); };
+  if (zero_copy_) {
+    const auto release = [](void* ctx, std::uint8_t* buffer) {
+      static_cast<simple_pseye_camera*>(ctx)->transport_->release_buffer(buffer);
+    };
+    buffer_pool_.reset(layout.max_handoff_buffers, release, this);
+    if (!segmented_frames_)
+      segmented_frames_ = std::make_unique<segmented_frame_queue>(3, buffer_pool_);
+    segmented_frames_->clear();
+    segmented_frames_->set_read_handler(on_read, this);
+    assembler_.reset(segmented_frames_.get(), &buffer_pool_, frame_size, layout.payload_size);
+  } else {
+    if (!frame_buffer_ || frame_buffer_->frame_size() != frame_size)
+      frame_buffer_ = std::make_unique<spsc_frame_buffer>(2, frame_size);
+    frame_buffer_->set_read_handler(on_read, this);
+    frame_buffer_->set_slice_handler(slice_handler_, slice_handler_ctx_);
+    assembler_.reset(frame_buffer_.get(), layout.payload_size);
+    if (slice_handler_ && rows_per_slice_ != 0)
+      assembler_.set_slice_rows(size_bytes(state_.format, state_.width, 1), rows_per_slice_);
+  }
+  assembler_.set_salvage_mode(options_.salvage_frames ? size_bytes(state_.format, state_.width, 1) : 0);
+  assembler_.set_clock_frequency(layout.clock_frequency);
+  clock_frequency_ = layout.clock_frequency;
+  last_read_ = std::chrono::steady_clock::now().time_since_epoch().count();
+  suspended_ = false;
+  if (recorder_)
+    recorder_->begin({layout.payload_size, state_.width, state_.height, state_.format, state_.rate});
+
+  resync_requested_ = false;
+  pipelined_ = layout.buffer_handoff;
+  if (pipelined_) {
+    pending_transfers_.reset(layout.max_handoff_buffers);
+    parser_exit_requested_ = false;
+    parser_thread_ = std::thread(&simple_pseye_camera::run_parser, this);
   }
 
-  PSEYE_LOG_DEBUG("setting: payload size {} frame size {}", payload_size, frame_size);
-  write_video_data(handle_, video_cfg);
+  try {
+    transport_->start();
+  } catch (...) {
+    // Leave nothing running, a reconnect attempt might start over
+    stop_parser();
+    throw;
+  }
+}
 
-  switch (mode) {
-    case size_mode::vga:
-      write_register(handle_, ov534::start_vga);
-      write_sccb_register(handle_, ov7725::sensor_start_vga);
-      com7_value |= ov7725::com7_res_vga;
-      break;
-    case size_mode::qvga:
-      write_register(handle_, ov534::start_qvga);
-      write_sccb_register(handle_, ov7725::sensor_start_qvga);
-      com7_value |= ov7725::com7_res_qvga;
+void simple_pseye_camera::stop_stream()
+{
+  // Our own threads & buffers have to go even if the transport fails to stop (e.g. because the device is gone)
+  std::exception_ptr transport_error;
+  try {
+    transport_->stop();
+  } catch (...) {
+    transport_error = std::current_exception();
+  }
+  stop_parser();
+
+  // Frames still pending point into buffers we can't keep past this point
+  if (zero_copy_) {
+    assembler_.release_pins();
+    buffer_pool_.detach();
+    segmented_frames_->clear();
+  }
+
+  if (transport_error)
+    std::rethrow_exception(transport_error);
+}
+
+void simple_pseye_camera::on_transfer_data(std::span<uint8_t> data)
+{
+  const auto completion_time = std::chrono::steady_clock::now();
+  if (!pipelined_) {
+    process_transfer_data(completion_time, data);
+    return;
+  }
+
+  // We own |data| until we release it, so just pass it on
+  pending_transfers_.try_push({completion_time, data});
+  pending_signal_.fetch_add(1, std::memory_order_release);
+  pending_signal_.notify_one();
+}
+
+void simple_pseye_camera::on_recovery(const usb_recovery_info& info)
+{
+  // We lost (parts of) a frame, don't stitch it to whatever comes next
+  if (info.event == usb_recovery_event::recovered)
+    resync_requested_.store(true, std::memory_order_release);
+
+  if (info.event == usb_recovery_event::device_lost) {
+    std::lock_guard lock(signal_mutex_);
+    device_lost_ = true;
+    signal_condition_.notify_all();
+  }
+
+  if (recovery_handler_)
+    recovery_handler_(recovery_handler_ctx_, info);
+}
+
+void simple_pseye_camera::on_hotplug(usb_hotplug_event event, libusb_device* device)
+{
+  if (event != usb_hotplug_event::arrived)
+    return;
+
+  // We're on the event thread, so the actual reopening is left to the reconnect thread
+  const auto info = get_device_info(device);
+  if (info.bus_number != reconnect_bus_number_ || info.port_path != reconnect_port_path_)
+    return;
+
+  std::lock_guard lock(signal_mutex_);
+  device_arrived_ = true;
+  signal_condition_.notify_all();
+}
+
+void simple_pseye_camera::on_frame_read()
+{
+  // Pairs with suspend_stream(): either we see the suspension, or it sees our read
+  last_read_ = std::chrono::steady_clock::now().time_since_epoch().count();
+  if (suspended_) {
+    std::lock_guard lock(idle_mutex_);
+    resume_requested_ = true;
+    idle_condition_.notify_one();
+  }
+}
+
+void simple_pseye_camera::run_idle_monitor()
+{
+  const auto timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(options_.idle_timeout);
+  std::unique_lock lock(idle_mutex_);
+  while (!idle_exit_requested_) {
+    if (!suspended_) {
+      const auto last_read = last_read_.load();
+      const auto idle_for = std::chrono::steady_clock::now().time_since_epoch() -
+                            std::chrono::steady_clock::duration(last_read);
+      if (idle_for < timeout) {
+        idle_condition_.wait_for(lock, timeout - idle_for, [this] { return idle_exit_requested_; });
+        continue;
+      }
+
+      lock.unlock();
+      const bool missed_read = suspend_stream(last_read);
+      lock.lock();
+      if (missed_read)
+        resume_requested_ = true;
+      continue;
+    }
+
+    idle_condition_.wait(lock, [this] { return idle_exit_requested_ || resume_requested_; });
+    if (idle_exit_requested_)
       break;
+
+    resume_requested_ = false;
+    lock.unlock();
+    resume_stream();
+    lock.lock();
+  }
+}
+
+void simple_pseye_camera::stop_idle_monitor()
+{
+  if (!idle_thread_.joinable())
+    return;
+
+  {
+    std::lock_guard lock(idle_mutex_);
+    idle_exit_requested_ = true;
   }
-  write_sccb_register(handle_, ov7725::reg::dsp_ctrl4, dsp_ctrl4_value);
-  write_sccb_register(handle_, ov7725::reg::com7, com7_value);
-  apply_state(handle_, state_);
+  idle_condition_.notify_one();
+  idle_thread_.join();
+}
 
-  write_register(handle_, ov534::reg::sys_ctrl,
-                 read_register(handle_, ov534::reg::sys_ctrl) & ~ov534::sys_ctrl_camera_power_down);
-  set_camera_led_status(handle_, true);
-  write_register(handle_, ov534::reg::reset0, 0x00);
+bool simple_pseye_camera::suspend_stream(std::chrono::steady_clock::rep last_read)
+{
+  std::lock_guard lock(stream_mutex_);
+  if (!is_active_ || suspended_)
+    return false;
 
-  payload_size_ = payload_size;
-  frame_buffer_ = std::make_unique<spsc_frame_buffer>(2, frame_size);
-  transfer_.start(handle_.get(), handle_.bulk_endpoint(), transfer_count, transfer_size);
-  is_active_ = true;
+  PSEYE_LOG_DEBUG("no frame read for {} ms, suspending", options_.idle_timeout.count());
+  transport_->suspend();
+  suspended_ = true;
+  // A read that didn't see us suspended yet has to resume us
+  return last_read_.load() != last_read;
 }
 
-void simple_pseye_camera::stop()
+void simple_pseye_camera::resume_stream()
 {
-  if (!is_active_)
+  std::lock_guard lock(stream_mutex_);
+  if (!is_active_ || !suspended_)
     return;
 
-  // XXX: OVT driver doesn't reset CIF?
-  write_register(handle_, ov534::reg::reset0, ov534::reset0_cif | ov534::reset0_vfifo);
-  write_register(handle_, ov534::reg::sys_ctrl,
-                 read_register(handle_, ov534::reg::sys_ctrl) | ov534::sys_ctrl_camera_power_down);
-  set_camera_led_status(handle_, false);
+  PSEYE_LOG_DEBUG("frame requested, resuming");
+  transport_->resume();
+  // The frame we were in the middle of is gone
+  resync_requested_.store(true, std::memory_order_release);
+  suspended_ = false;
+}
 
-  transfer_.stop();
-  is_active_ = false;
+void simple_pseye_camera::run_reconnect()
+{
+  std::unique_lock lock(signal_mutex_);
+  while (true) {
+    signal_condition_.wait(lock, [this] { return reconnect_exit_requested_ || device_lost_; });
+    if (reconnect_exit_requested_)
+      break;
+
+    device_lost_ = false;
+    device_arrived_ = false;
+    lock.unlock();
+    reconnect();
+    lock.lock();
+  }
 }
 
-void simple_pseye_camera::initialize()
-{
-  // reset camera bridge
-  write_register(handle_, ov534::reg::sys_ctrl,
-                 ov534::sys_ctrl_suspend_enable | ov534::sys_ctrl_mc_wakeup_reset_enable | ov534::sys_ctrl_reset_3 |
-                     ov534::sys_ctrl_reset_5);
-  write_register(handle_, ov534::reg::reset0, ov534::reset0_vfifo);
-  std::this_thread::sleep_for(std::chrono::milliseconds(50)); // wait for stabilization afterwards
-
-  // set the SCCB target sensor to our OV772x
-  write_register(handle_, ov534::reg::ms_id, 0x42);
-
-  // reset sensor
-  write_sccb_register(handle_, ov7725::reg::com7, ov7725::com7_sccb_reset);
-  std::this_thread::sleep_for(std::chrono::milliseconds(16)); // wait for stabilization afterwards
-
-  uint16_t product_id = read_sccb_register(handle_, ov7725::reg::pid) << 8;
-  product_id |= read_sccb_register(handle_, ov7725::reg::ver);
-  PSEYE_LOG_INFO("Sensor ID: OV{:04x}", product_id);
-
-  write_register(handle_, ov534::initialization_data);
-  write_sccb_register(handle_, ov7725::initialization_data);
-  write_register(handle_, ov534::reg::reset0, ov534::reset0_cif | ov534::reset0_vfifo);
-}
-
-void simple_pseye_camera::process_transfer_data(std::span<uint8_t> data)
-{
-  // Process the input data in |payload_size_|-sized chunks
-  do {
-    const auto payload = data.subspan(0, std::min<std::size_t>(payload_size_, data.size()));
-    switch (processor_.put(payload)) {
-      case uvc_frame_processor::status::need_data:
-        // we successfully read that payload block
-        data = data.subspan(payload.size());
-        break;
-      case uvc_frame_processor::status::need_buffer:
-        // we might've been reset - just give it the current frame
-        processor_.set_frame(frame_buffer_->writable_frame());
-        break;
-      case uvc_frame_processor::status::frame_complete:
-        frame_buffer_->finish_writing();
-        processor_.set_frame(frame_buffer_->writable_frame());
-        data = data.subspan(payload.size());
-        break;
+void simple_pseye_camera::reconnect()
+{
+  {
+    std::lock_guard lock(stream_mutex_);
+    if (!is_active_)
+      return;
+
+    // The transport is replaced anyway, and there's nobody to report errors to on this thread
+    try {
+      stop_stream();
+    } catch (const std::exception& e) {
+      PSEYE_LOG_WARNING("failed to stop the stream of the lost camera: {}", e.what());
+    }
+  }
+
+  pseye_device_info info;
+  info.bus_number = reconnect_bus_number_;
+  info.port_path = reconnect_port_path_;
+  PSEYE_LOG_WARNING("lost camera at {}, waiting for it to return", info.location());
+
+  const auto lost_time = std::chrono::steady_clock::now();
+  while (true) {
+    {
+      std::unique_lock lock(signal_mutex_);
+      signal_condition_.wait_for(lock, reconnect_policy_.retry_interval,
+                                 [this] { return reconnect_exit_requested_ || device_arrived_; });
+      if (reconnect_exit_requested_)
+        return;
+      device_arrived_ = false;
+    }
+
+    std::lock_guard lock(stream_mutex_);
+    if (!is_active_)
+      return; // stopped in the meantime
+
+    try {
+      std::unique_ptr<camera_transport> transport;
+      usb_camera_transport* usb_transport = nullptr;
+      if (reconnect_policy_.reopen) {
+        transport = reconnect_policy_.reopen(reconnect_policy_.reopen_ctx);
+        usb_transport = dynamic_cast<usb_camera_transport*>(transport.get());
+      } else {
+        pseye_endpoints endpoints;
+        const auto handle = reconnect_policy_.topology
+                                ? reconnect_policy_.topology->open(info.bus_number, info.port_path, &endpoints)
+                                : open_pseye_device(*reconnect_context_, info);
+        if (handle) {
+          // Fully re-initializes the device, start_stream() then restores our state
+          auto usb = std::make_unique<usb_camera_transport>(handle, endpoints);
+          usb_transport = usb.get();
+          transport = std::move(usb);
+        }
+      }
+      if (transport) {
+        usb_transport_ = usb_transport;
+        attach_transport(std::move(transport));
+        start_stream();
+        PSEYE_LOG_INFO("reconnected camera at {} after {} ms", info.location(),
+                       std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                                                             lost_time)
+                           .count());
+        return;
+      }
+    } catch (const usb_error& e) {
+      PSEYE_LOG_WARNING("failed to reopen camera at {}: {}", info.location(), e.what());
+    } catch (const std::exception& e) {
+      // Anything escaping this thread would terminate the process, treat it as just another failed attempt
+      PSEYE_LOG_ERROR("unexpected error while reopening camera at {}: {}", info.location(), e.what());
     }
-  } while (!data.empty());
+
+    if (reconnect_policy_.timeout.count() != 0 &&
+        std::chrono::steady_clock::now() - lost_time >= reconnect_policy_.timeout) {
+      PSEYE_LOG_ERROR("giving up on camera at {}", info.location());
+      is_active_ = false;
+      return;
+    }
+  }
+}
+
+void simple_pseye_camera::run_parser()
+{
+  PSEYE_LOG_DEBUG("entering transfer parser loop");
+
+  auto signal = pending_signal_.load(std::memory_order_acquire);
+  while (true) {
+    pending_transfer pending;
+    while (pending_transfers_.try_pop(pending)) {
+      process_transfer_data(pending.completion_time, pending.data);
+      // The assembler releases pinned buffers itself
+      if (!zero_copy_)
+        transport_->release_buffer(pending.data.data());
+    }
+
+    if (parser_exit_requested_)
+      break;
+
+    pending_signal_.wait(signal, std::memory_order_acquire);
+    signal = pending_signal_.load(std::memory_order_acquire);
+  }
+
+  PSEYE_LOG_DEBUG("exiting transfer parser loop");
+}
+
+void simple_pseye_camera::stop_parser()
+{
+  if (!parser_thread_.joinable())
+    return;
+
+  // No more transfers are coming in at this point, so the parser drains its queue and exits
+  parser_exit_requested_ = true;
+  pending_signal_.fetch_add(1, std::memory_order_release);
+  pending_signal_.notify_one();
+  parser_thread_.join();
+}
+
+void simple_pseye_camera::process_transfer_data(std::chrono::steady_clock::time_point completion_time,
+                                                std::span<uint8_t> data)
+{
+  if (resync_requested_.load(std::memory_order_relaxed) && resync_requested_.exchange(false))
+    assembler_.resync();
+  if (recorder_)
+    recorder_->write(completion_time, data);
+  if (zero_copy_)
+    assembler_.put_pinned(data, completion_time);
+  else
+    assembler_.put(data, completion_time);
 }
 
 PSEYE_NS_END
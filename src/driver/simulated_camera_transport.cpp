@@ -0,0 +1,327 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/simulated_camera_transport.hpp"
+
+#include "pseye/log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+
+PSEYE_NS_BEGIN
+
+namespace
+{
+
+using clock = std::chrono::steady_clock;
+
+// Same payload layout as the OV534
+using ov534::payload_header_size;
+
+inline constexpr std::uint8_t UVC_STREAM_FID = 1 << 0;
+inline constexpr std::uint8_t UVC_STREAM_EOF = 1 << 1;
+inline constexpr std::uint8_t UVC_STREAM_PTS = 1 << 2;
+inline constexpr std::uint8_t UVC_STREAM_SCR = 1 << 3;
+inline constexpr std::uint8_t UVC_STREAM_ERR = 1 << 6;
+inline constexpr std::uint8_t UVC_STREAM_EOH = 1 << 7;
+
+struct rgb
+{
+  std::uint8_t r, g, b;
+};
+
+rgb sample_pattern(simulated_pattern pattern, std::uint32_t x, std::uint32_t y, std::uint32_t width, std::uint32_t height)
+{
+  switch (pattern) {
+    case simulated_pattern::color_bars: {
+      static constexpr rgb bars[] = {
+          {255, 255, 255},
+          {255, 255,   0},
+          {  0, 255, 255},
+          {  0, 255,   0},
+          {255,   0, 255},
+          {255,   0,   0},
+          {  0,   0, 255},
+          {  0,   0,   0},
+      };
+      return bars[x * std::size(bars) / width];
+    }
+    case simulated_pattern::gradient:
+      return {static_cast<std::uint8_t>(x * 255 / (width - 1)), static_cast<std::uint8_t>(y * 255 / (height - 1)),
+              128};
+    case simulated_pattern::checkerboard: {
+      const std::uint8_t value = ((x / 32) ^ (y / 32)) & 1 ? 255 : 0;
+      return {value, value, value};
+    }
+  }
+  return {};
+}
+
+// GRBG: green/red rows followed by blue/green rows
+std::uint8_t bayer_sample(const rgb& c, std::uint32_t x, std::uint32_t y)
+{
+  if (y % 2 == 0)
+    return x % 2 == 0 ? c.g : c.r;
+  return x % 2 == 0 ? c.b : c.g;
+}
+
+// BT.601, studio swing
+std::uint8_t rgb_to_y(const rgb& c)
+{
+  return static_cast<std::uint8_t>(((66 * c.r + 129 * c.g + 25 * c.b + 128) >> 8) + 16);
+}
+
+std::uint8_t rgb_to_u(const rgb& c)
+{
+  return static_cast<std::uint8_t>(((-38 * c.r - 74 * c.g + 112 * c.b + 128) >> 8) + 128);
+}
+
+std::uint8_t rgb_to_v(const rgb& c)
+{
+  return static_cast<std::uint8_t>(((112 * c.r - 94 * c.g - 18 * c.b + 128) >> 8) + 128);
+}
+
+std::uint32_t device_clock(clock::duration since_start)
+{
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(since_start).count();
+  return static_cast<std::uint32_t>(ns * (simulated_camera_transport::clock_frequency / 1'000'000) / 1000);
+}
+
+template <typename T>
+void put(std::uint8_t* out, T value)
+{
+  // NOTE: all our targets are little-endian
+  std::memcpy(out, &value, sizeof(value));
+}
+
+} // namespace
+
+simulated_camera_transport::simulated_camera_transport(const simulator_settings& settings)
+  : settings_(settings)
+{
+}
+
+simulated_camera_transport::~simulated_camera_transport()
+{
+  stop();
+}
+
+camera_stream_layout simulated_camera_transport::configure(pseye_device_state& state,
+                                                           const usb_stream_options& options)
+{
+  switch (state.format) {
+    case pixel_format::grbg8:
+    case pixel_format::grbg10:
+      // like the real thing
+      state.flip_v = true;
+      break;
+    case pixel_format::yuyv:
+    case pixel_format::uyvy: break;
+    default: throw std::runtime_error("unsupported transfer pixel format");
+  }
+
+  frame_rate_ = settings_.frame_rate > 0.0 ? settings_.frame_rate : state.rate;
+  payload_size_ = ov534::bulk_payload_size;
+  render_frame(state);
+
+  // Isochronous transfers deliver one payload at a time
+  const bool iso = options.transfer_mode == ov534::transfer::iso;
+  transfer_size_ = iso ? payload_size_ : std::max<std::size_t>(settings_.transfer_size / payload_size_, 1) * payload_size_;
+
+  camera_stream_layout layout;
+  layout.clock_frequency = clock_frequency;
+  layout.payload_size = payload_size_;
+  handoff_enabled_ = options.pipelined && !iso;
+  if (handoff_enabled_) {
+    const auto num_buffers = std::max<std::size_t>(options.spare_buffers, 2);
+    buffers_.resize(num_buffers * transfer_size_);
+    free_buffers_.reset(num_buffers);
+    for (std::size_t index = 0; index < num_buffers; ++index)
+      free_buffers_.try_push(&buffers_[index * transfer_size_]);
+
+    layout.buffer_handoff = true;
+    layout.max_handoff_buffers = num_buffers;
+  } else {
+    buffers_.resize(transfer_size_);
+  }
+
+  PSEYE_LOG_DEBUG("simulating {}x{} at {} fps: payload size {} frame size {}", state.width, state.height, frame_rate_,
+                  payload_size_, frame_.size());
+  return layout;
+}
+
+void simulated_camera_transport::start()
+{
+  stop_requested_ = false;
+  num_frames_ = 0;
+  num_dropped_transfers_ = 0;
+  thread_ = std::thread(&simulated_camera_transport::run, this);
+}
+
+void simulated_camera_transport::stop()
+{
+  stop_requested_ = true;
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void simulated_camera_transport::render_frame(const pseye_device_state& state)
+{
+  const auto width = state.width;
+  const auto height = state.height;
+  frame_.resize(size_bytes(state.format, width, height));
+
+  // The sensor scans bottom-up if the stream is flipped
+  const auto image_row = [&](std::uint32_t y) { return state.flip_v ? height - 1 - y : y; };
+
+  switch (state.format) {
+    case pixel_format::grbg8:
+      for (std::uint32_t y = 0; y < height; ++y) {
+        for (std::uint32_t x = 0; x < width; ++x)
+          frame_[y * width + x] = bayer_sample(sample_pattern(settings_.pattern, x, image_row(y), width, height), x, y);
+      }
+      break;
+    case pixel_format::grbg10:
+      // groups of 4 pixels: their upper 8 bits followed by a byte with all lower 2 bits
+      for (std::uint32_t y = 0; y < height; ++y) {
+        auto out = &frame_[y * width * 5 / 4];
+        for (std::uint32_t x = 0; x < width; x += 4, out += 5) {
+          out[4] = 0;
+          for (std::uint32_t i = 0; i < 4; ++i) {
+            const auto value = bayer_sample(sample_pattern(settings_.pattern, x + i, image_row(y), width, height), x + i, y);
+            out[i] = value;
+            out[4] |= static_cast<std::uint8_t>((value >> 6) << (2 * i));
+          }
+        }
+      }
+      break;
+    case pixel_format::yuyv:
+    case pixel_format::uyvy: {
+      const bool yuyv = state.format == pixel_format::yuyv;
+      for (std::uint32_t y = 0; y < height; ++y) {
+        auto out = &frame_[y * width * 2];
+        for (std::uint32_t x = 0; x < width; x += 2, out += 4) {
+          const auto c0 = sample_pattern(settings_.pattern, x, y, width, height);
+          const auto c1 = sample_pattern(settings_.pattern, x + 1, y, width, height);
+          const std::uint8_t values[4] = {rgb_to_y(c0), rgb_to_u(c0), rgb_to_y(c1), rgb_to_v(c0)};
+          if (yuyv) {
+            std::memcpy(out, values, 4);
+          } else {
+            out[0] = values[1];
+            out[1] = values[0];
+            out[2] = values[3];
+            out[3] = values[2];
+          }
+        }
+      }
+      break;
+    }
+    default: break;
+  }
+}
+
+void simulated_camera_transport::run()
+{
+  PSEYE_LOG_DEBUG("entering simulator loop");
+
+  std::mt19937 rng(settings_.seed);
+  std::bernoulli_distribution error_bit(settings_.error_bit_probability);
+  std::bernoulli_distribution missing_pts(settings_.missing_pts_probability);
+  std::bernoulli_distribution truncated_frame(settings_.truncated_frame_probability);
+
+  const std::size_t payload_data_size = payload_size_ - payload_header_size;
+  const std::size_t num_payloads = (frame_.size() + payload_data_size - 1) / payload_data_size;
+  const auto frame_period =
+      std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / frame_rate_));
+  const auto start_time = clock::now();
+
+  std::uint8_t* buffer = handoff_enabled_ ? nullptr : buffers_.data();
+  std::size_t transfer_len = 0;
+
+  for (std::uint64_t frame_index = 0; !stop_requested_; ++frame_index) {
+    const auto frame_start = start_time + frame_period * static_cast<clock::rep>(frame_index);
+    const auto pts = device_clock(frame_start - start_time);
+    const std::uint8_t fid = (frame_index & 1) ? UVC_STREAM_FID : 0;
+
+    // A truncated frame ends early, with its EOF on what should have been a payload in the middle
+    std::size_t frame_payloads = num_payloads;
+    if (num_payloads > 1 && truncated_frame(rng))
+      frame_payloads = 1 + rng() % (num_payloads - 1);
+
+    for (std::size_t payload = 0; payload < frame_payloads && !stop_requested_; ++payload) {
+      const bool eof = payload + 1 == frame_payloads;
+
+      // A transfer that started without a buffer is lost as a whole, a buffer freed up halfway through waits for the
+      // next one
+      if (!buffer && transfer_len == 0) {
+        // Without pacing we wait for the receiver, otherwise the transfer is lost like it would be on the bus
+        while (!free_buffers_.try_pop(buffer) && !settings_.real_time && !stop_requested_)
+          std::this_thread::yield();
+      }
+
+      const auto offset = payload * payload_data_size;
+      const auto data_len = std::min(payload_data_size, frame_.size() - offset);
+      if (buffer) {
+        const auto out = buffer + transfer_len;
+        std::uint8_t flags = UVC_STREAM_EOH | UVC_STREAM_SCR | UVC_STREAM_PTS | fid;
+        if (eof)
+          flags |= UVC_STREAM_EOF;
+        if (error_bit(rng))
+          flags |= UVC_STREAM_ERR;
+        if (missing_pts(rng))
+          flags &= ~UVC_STREAM_PTS;
+
+        const auto since_start = clock::now() - start_time;
+        out[0] = payload_header_size;
+        out[1] = flags;
+        put<std::uint32_t>(out + 2, pts);
+        put<std::uint32_t>(out + 6, device_clock(since_start));
+        // USB (full speed) frame number, 11 bits
+        put<std::uint16_t>(out + 10, static_cast<std::uint16_t>(
+                                         std::chrono::duration_cast<std::chrono::milliseconds>(since_start).count() &
+                                         0x7ff));
+        std::memcpy(out + payload_header_size, &frame_[offset], data_len);
+      }
+      transfer_len += payload_header_size + data_len;
+
+      // Transfers end early with a short payload, which the EOF one usually is
+      if (!eof && transfer_len + payload_size_ <= transfer_size_)
+        continue;
+
+      if (settings_.real_time) {
+        std::this_thread::sleep_until(frame_start + frame_period * static_cast<clock::rep>(payload + 1) /
+                                                        static_cast<clock::rep>(num_payloads));
+      }
+
+      if (buffer) {
+        handler_(handler_ctx_, std::span(buffer, transfer_len));
+        if (handoff_enabled_)
+          buffer = nullptr;
+      } else {
+        num_dropped_transfers_.fetch_add(1, std::memory_order_relaxed);
+      }
+      transfer_len = 0;
+    }
+
+    num_frames_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  PSEYE_LOG_DEBUG("exiting simulator loop");
+}
+
+PSEYE_NS_END
@@ -19,6 +19,7 @@ PSEYE_NS_BEGIN
 spsc_frame_buffer::spsc_frame_buffer(std::uint32_t num_frames, std::size_t frame_size)
   : frame_size_(frame_size)
   , frames_(new uint8_t[frame_size * num_frames])
+  , metadata_(new frame_metadata[num_frames])
   , num_frames_(num_frames)
 {
 }
@@ -29,9 +30,23 @@ std::span<uint8_t> spsc_frame_buffer::writable_frame()
   return {&frames_[head_ * frame_size_], frame_size_};
 }
 
-void spsc_frame_buffer::finish_writing()
+void spsc_frame_buffer::publish_slice(std::size_t row_size,
+                                      std::size_t first_row,
+                                      std::size_t num_rows,
+                                      std::uint64_t sequence)
+{
+  if (!slice_handler_)
+    return;
+
+  const auto frame = writable_frame();
+  slice_handler_(slice_handler_ctx_,
+                 {frame.subspan(first_row * row_size, num_rows * row_size), first_row, num_rows, sequence});
+}
+
+void spsc_frame_buffer::finish_writing(const frame_metadata& metadata)
 {
   std::unique_lock lock(mutex_);
+  metadata_[head_] = metadata;
   // Unlike other SPSC queues we simply keep overwriting the last frame we wrote if we end up full.
   // That is, we do nothing here and let the producer just keep writing to the frame buffer it has.
   const bool is_full = used_ == num_frames_ - 1;
@@ -44,6 +59,7 @@ void spsc_frame_buffer::finish_writing()
 
 std::span<std::uint8_t> spsc_frame_buffer::readable_frame_wait()
 {
+  notify_read();
   std::unique_lock lock(mutex_);
   new_frame_condition_.wait(lock, [this]() {
     return used_ != 0;
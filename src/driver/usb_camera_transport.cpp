@@ -0,0 +1,288 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/usb_camera_transport.hpp"
+#include "pseye/driver/pseye_device_controller_ops.hpp"
+#include "pseye/exception.hpp"
+#include "pseye/log.hpp"
+
+#include <libusb.h>
+
+#include <chrono>
+#include <thread>
+
+PSEYE_NS_BEGIN
+
+namespace
+{
+
+template <typename Register, std::size_t N>
+void verify_register_sequence(const register_setting<Register> (&a)[N], const register_setting<Register> (&b)[N])
+{
+  for (std::size_t i = 0; i < N; ++i) {
+    if (a[i].reg != b[i].reg || a[i].value != b[i].value)
+      PSEYE_LOG_ERROR("mismatch {}: {} {} != {} {}", i, static_cast<int>(a[i].reg), a[i].value,
+                      static_cast<int>(b[i].reg), b[i].value);
+  }
+}
+
+} // namespace
+
+inline constexpr std::size_t transfer_count = 5;
+inline constexpr std::size_t transfer_size = 0x10000;
+
+usb_camera_transport::usb_camera_transport(libusb_device* device)
+  : handle_(device, pseye_interface_number)
+  , transfer_(&usb_camera_transport::on_transfer_data, this)
+{
+  initialize();
+}
+
+usb_camera_transport::usb_camera_transport(libusb_device_handle* device)
+  : handle_(device, pseye_interface_number)
+  , transfer_(&usb_camera_transport::on_transfer_data, this)
+{
+  initialize();
+}
+
+usb_camera_transport::usb_camera_transport(libusb_device_handle* device, const pseye_endpoints& endpoints)
+  : handle_(device, pseye_interface_number, endpoints)
+  , transfer_(&usb_camera_transport::on_transfer_data, this)
+{
+  initialize();
+}
+
+void usb_camera_transport::on_transfer_data(void* ctx, std::span<std::uint8_t> data)
+{
+  const auto self = static_cast<usb_camera_transport*>(ctx);
+  self->handler_(self->handler_ctx_, data);
+}
+
+void usb_camera_transport::on_recovery(void* ctx, const usb_recovery_info& info)
+{
+  const auto self = static_cast<usb_camera_transport*>(ctx);
+  if (info.event == usb_recovery_event::device_lost)
+    self->device_lost_ = true;
+  if (self->recovery_handler_)
+    self->recovery_handler_(self->recovery_handler_ctx_, info);
+}
+
+usb_camera_transport::~usb_camera_transport()
+{
+  stop();
+}
+
+camera_stream_layout usb_camera_transport::configure(pseye_device_state& state, const usb_stream_options& options)
+{
+  const std::uint32_t frame_size = size_bytes(state.format, state.width, state.height);
+  std::uint32_t payload_size = ov534::bulk_payload_size;
+
+  usb_transfer_settings transfer_settings;
+  transfer_settings.buffer_allocation = options.buffer_allocation;
+  transfer_settings.max_recovery_attempts = options.max_recovery_attempts;
+  if (options.transfer_mode == ov534::transfer::iso) {
+    if (handle_.iso_endpoint() == 0)
+      throw usb_error(LIBUSB_ERROR_NOT_SUPPORTED, "device has no isochronous endpoint");
+
+    auto ret = ::libusb_set_interface_alt_setting(handle_.get(), handle_.interface_index(),
+                                                  handle_.iso_alternate_setting());
+    if (ret != LIBUSB_SUCCESS) {
+      PSEYE_LOG_ERROR("failed to select alternate setting {}: {} {}", handle_.iso_alternate_setting(), ret,
+                      ::libusb_error_name(ret));
+      throw usb_error(ret, "failed to select isochronous alternate setting");
+    }
+
+    ret = ::libusb_get_max_iso_packet_size(::libusb_get_device(handle_.get()), handle_.iso_endpoint());
+    if (ret <= 0)
+      throw usb_error(ret, "failed to query isochronous packet size");
+
+    // Every isochronous packet carries exactly one UVC payload
+    payload_size = static_cast<std::uint32_t>(ret);
+    transfer_settings.endpoint = handle_.iso_endpoint();
+    transfer_settings.num_transfers = transfer_count;
+    transfer_settings.num_iso_packets = options.iso_packets_per_transfer;
+    transfer_settings.transfer_size = options.iso_packets_per_transfer * payload_size;
+  } else {
+    transfer_settings.endpoint = handle_.bulk_endpoint();
+    transfer_settings.num_transfers = transfer_count;
+    transfer_settings.transfer_size = transfer_size;
+    transfer_settings.tuning = options.tuning;
+    transfer_settings.tuning.granularity = payload_size;
+    const auto payload_data_size = payload_size - ov534::payload_header_size;
+    transfer_settings.tuning.frame_size = (frame_size + payload_data_size - 1) / payload_data_size * payload_size;
+    if (options.pipelined)
+      transfer_settings.num_spare_buffers = options.spare_buffers;
+  }
+
+  ov534::video_data_configuration video_cfg;
+  std::uint8_t com7_value = 0;
+  std::uint8_t dsp_ctrl4_value = 0;
+
+  switch (state.format) {
+    case pixel_format::grbg8:
+      state.flip_v = true;
+      video_cfg = ov534::make_video_data_settings(ov534::video_format::raw8, options.transfer_mode, payload_size / 4,
+                                                  frame_size / 4);
+      com7_value |= ov7725::com7_ofmt_processed_bayer;
+      dsp_ctrl4_value |= ov7725::dsp_ctrl4_output_raw8;
+      write_register(handle_, ov534::start_bayer);
+      break;
+    case pixel_format::grbg10:
+      state.flip_v = true;
+      video_cfg = ov534::make_video_data_settings(ov534::video_format::raw10, options.transfer_mode, payload_size / 4,
+                                                  frame_size / 4);
+      com7_value |= ov7725::com7_ofmt_processed_bayer;
+      dsp_ctrl4_value |= ov7725::dsp_ctrl4_output_raw10;
+      write_register(handle_, ov534::start_bayer);
+      break;
+    case pixel_format::yuyv:
+      video_cfg = ov534::make_video_data_settings(ov534::video_format::yuv422, options.transfer_mode, payload_size / 4,
+                                                  frame_size / 4, false, true);
+      com7_value |= ov7725::com7_ofmt_yuv;
+      dsp_ctrl4_value |= ov7725::dsp_ctrl4_output_yuv;
+      write_register(handle_, ov534::start_yuv);
+      break;
+    case pixel_format::uyvy:
+      video_cfg = ov534::make_video_data_settings(ov534::video_format::yuv422, options.transfer_mode, payload_size / 4,
+                                                  frame_size / 4, false, false);
+      com7_value |= ov7725::com7_ofmt_yuv;
+      dsp_ctrl4_value |= ov7725::dsp_ctrl4_output_yuv;
+      write_register(handle_, ov534::start_yuv);
+      break;
+    default: throw std::runtime_error("unsupported transfer pixel format");
+  }
+
+  PSEYE_LOG_DEBUG("setting: payload size {} frame size {}", payload_size, frame_size);
+  write_video_data(handle_, video_cfg);
+
+  switch (state.mode()) {
+    case size_mode::vga:
+      write_register(handle_, ov534::start_vga);
+      write_sccb_register(handle_, ov7725::sensor_start_vga);
+      com7_value |= ov7725::com7_res_vga;
+      break;
+    case size_mode::qvga:
+      write_register(handle_, ov534::start_qvga);
+      write_sccb_register(handle_, ov7725::sensor_start_qvga);
+      com7_value |= ov7725::com7_res_qvga;
+      break;
+  }
+  write_sccb_register(handle_, ov7725::reg::dsp_ctrl4, dsp_ctrl4_value);
+  write_sccb_register(handle_, ov7725::reg::com7, com7_value);
+  apply_state(handle_, state);
+
+  write_register(handle_, ov534::reg::sys_ctrl,
+                 read_register(handle_, ov534::reg::sys_ctrl) & ~ov534::sys_ctrl_camera_power_down);
+  set_camera_led_status(handle_, true);
+  write_register(handle_, ov534::reg::reset0, 0x00);
+
+  transfer_mode_ = options.transfer_mode;
+  transfer_settings_ = transfer_settings;
+  is_active_ = true;
+
+  camera_stream_layout layout;
+  layout.payload_size = payload_size;
+  // Hand-off is only done for bulk transfers, see usb_transfer_controller::start()
+  layout.buffer_handoff = transfer_settings.num_spare_buffers != 0;
+  if (layout.buffer_handoff) {
+    // every buffer might end up with the receiver at once
+    const auto max_transfers = transfer_settings.tuning.enabled ? transfer_settings.tuning.max_transfers
+                                                                : transfer_settings.num_transfers;
+    layout.max_handoff_buffers = max_transfers + transfer_settings.num_spare_buffers;
+  }
+  return layout;
+}
+
+void usb_camera_transport::start()
+{
+  transfer_.start(handle_.get(), transfer_settings_);
+}
+
+void usb_camera_transport::suspend()
+{
+  if (!is_active_)
+    return;
+
+  // Unlike stop(), the bridge & sensor registers and the transfers stay as they are
+  transfer_.pause();
+  write_register(handle_, ov534::reg::sys_ctrl,
+                 read_register(handle_, ov534::reg::sys_ctrl) | ov534::sys_ctrl_camera_power_down);
+  set_camera_led_status(handle_, false);
+}
+
+void usb_camera_transport::resume()
+{
+  if (!is_active_)
+    return;
+
+  write_register(handle_, ov534::reg::sys_ctrl,
+                 read_register(handle_, ov534::reg::sys_ctrl) & ~ov534::sys_ctrl_camera_power_down);
+  set_camera_led_status(handle_, true);
+  transfer_.resume();
+}
+
+void usb_camera_transport::stop()
+{
+  if (!is_active_)
+    return;
+  is_active_ = false;
+
+  // The transfers have to go whether or not the device is still around to talk to
+  transfer_.stop();
+
+  try {
+    // XXX: OVT driver doesn't reset CIF?
+    write_register(handle_, ov534::reg::reset0, ov534::reset0_cif | ov534::reset0_vfifo);
+    write_register(handle_, ov534::reg::sys_ctrl,
+                   read_register(handle_, ov534::reg::sys_ctrl) | ov534::sys_ctrl_camera_power_down);
+    set_camera_led_status(handle_, false);
+  } catch (const usb_error& e) {
+    // We're also called from our destructor, so this is as far as it goes
+    if (device_lost_ || e.libusb_error() == LIBUSB_ERROR_NO_DEVICE)
+      PSEYE_LOG_DEBUG("not powering down lost camera: {}", e.what());
+    else
+      PSEYE_LOG_ERROR("failed to power down camera: {}", e.what());
+  }
+
+  // give up the bandwidth reserved by the isochronous alternate setting
+  if (transfer_mode_ == ov534::transfer::iso)
+    ::libusb_set_interface_alt_setting(handle_.get(), handle_.interface_index(), 0);
+}
+
+void usb_camera_transport::initialize()
+{
+  transfer_.set_recovery_handler(&usb_camera_transport::on_recovery, this);
+
+  // reset camera bridge
+  write_register(handle_, ov534::reg::sys_ctrl,
+                 ov534::sys_ctrl_suspend_enable | ov534::sys_ctrl_mc_wakeup_reset_enable | ov534::sys_ctrl_reset_3 |
+                     ov534::sys_ctrl_reset_5);
+  write_register(handle_, ov534::reg::reset0, ov534::reset0_vfifo);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50)); // wait for stabilization afterwards
+
+  // set the SCCB target sensor to our OV772x
+  write_register(handle_, ov534::reg::ms_id, 0x42);
+
+  // reset sensor
+  write_sccb_register(handle_, ov7725::reg::com7, ov7725::com7_sccb_reset);
+  std::this_thread::sleep_for(std::chrono::milliseconds(16)); // wait for stabilization afterwards
+
+  PSEYE_LOG_INFO("Sensor ID: OV{:04x}", read_sensor_id(handle_));
+
+  write_register(handle_, ov534::initialization_data);
+  write_sccb_register(handle_, ov7725::initialization_data);
+  write_register(handle_, ov534::reg::reset0, ov534::reset0_cif | ov534::reset0_vfifo);
+}
+
+PSEYE_NS_END
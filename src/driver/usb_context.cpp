@@ -13,16 +13,37 @@
 /// You should have received a copy of the GNU General Public License
 /// along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "pseye/driver/usb_context.hpp"
+#include "pseye/driver/pseye_device_controller.hpp"
+#include "pseye/driver/pseye_topology_cache.hpp"
 
 #include "pseye/exception.hpp"
 #include "pseye/log.hpp"
 
 #include <libusb.h>
 
+#include <algorithm>
 #include <span>
+#include <string>
 
 PSEYE_NS_BEGIN
 
+struct usb_hotplug_registration
+{
+  usb_context::hotplug_handler handler = nullptr;
+  void* ctx = nullptr;
+  libusb_hotplug_callback_handle handle = 0;
+};
+
+static int LIBUSB_CALL on_hotplug(libusb_context*, libusb_device* device, libusb_hotplug_event event, void* user_data)
+{
+  const auto registration = static_cast<const usb_hotplug_registration*>(user_data);
+  registration->handler(registration->ctx,
+                        event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED ? usb_hotplug_event::arrived
+                                                                     : usb_hotplug_event::left,
+                        device);
+  return 0; // stay registered
+}
+
 void LIBUSB_CALL libusb_log_cb(libusb_context*, libusb_log_level level, const char* str)
 {
   std::string_view message(str);
@@ -37,7 +58,8 @@ void LIBUSB_CALL libusb_log_cb(libusb_context*, libusb_log_level level, const ch
   }
 }
 
-usb_context::usb_context()
+usb_context::usb_context(const usb_context_options& context_options)
+  : options_(context_options)
 {
   PSEYE_LOG_DEBUG("usb_context::usb_context");
   libusb_init_option log_cb_option;
@@ -47,35 +69,247 @@ usb_context::usb_context()
   const libusb_init_option options[] = {
       log_cb_option, {LIBUSB_OPTION_LOG_LEVEL, {LIBUSB_LOG_LEVEL_INFO}},
  // { LIBUSB_OPTION_USE_USBDK, 1 /*unused*/ },
+      {LIBUSB_OPTION_NO_DEVICE_DISCOVERY, {0}},
   };
+  // The discovery option has to be left out entirely to keep discovering devices
+  const int num_options = static_cast<int>(std::size(options)) - (options_.no_device_discovery ? 0 : 1);
 
-  const auto ret = ::libusb_init_context(&usb_context_, options, std::size(options));
-  if (0 != ret) {
-    PSEYE_LOG_ERROR("failed to init libusb context: {} {}", ret, ::libusb_error_name(ret));
-    throw usb_error(ret, "failed to init libusb context");
+  event_loops_.resize(std::max<std::size_t>(options_.num_event_loops, 1));
+  for (auto& loop : event_loops_) {
+    const auto ret = ::libusb_init_context(&loop.context, options, num_options);
+    if (0 != ret) {
+      PSEYE_LOG_ERROR("failed to init libusb context: {} {}", ret, ::libusb_error_name(ret));
+      for (auto& initialized : event_loops_)
+        if (initialized.context)
+          ::libusb_exit(initialized.context);
+      throw usb_error(ret, "failed to init libusb context");
+    }
   }
 
-  event_loop_thread_ = std::thread(&usb_context::run_event_loop, this);
+  if (options_.external_event_loop)
+    return;
+
+  for (std::size_t i = 0; i != event_loops_.size(); ++i)
+    event_loops_[i].thread = std::thread(&usb_context::run_event_loop, this, i);
 }
 
 usb_context::~usb_context()
 {
   PSEYE_LOG_DEBUG("usb_context::~usb_context");
+  for (const auto& registration : hotplug_registrations_)
+    ::libusb_hotplug_deregister_callback(event_loops_.front().context, registration->handle);
+
   exit_requested_ = true;
-  event_loop_thread_.join();
-  ::libusb_exit(usb_context_);
+  for (auto& loop : event_loops_) {
+    if (loop.thread.joinable())
+      loop.thread.join();
+    if (pollfd_added_)
+      ::libusb_set_pollfd_notifiers(loop.context, nullptr, nullptr, nullptr);
+    ::libusb_exit(loop.context);
+  }
 }
 
 libusb_device_handle* usb_context::open_device(std::uint16_t vendor_id, std::uint16_t product_id)
 {
-  return ::libusb_open_device_with_vid_pid(usb_context_, vendor_id, product_id);
+  if (const auto cache = topology_cache(); cache && vendor_id == pseye_vendor_id && product_id == pseye_product_id) {
+    const auto entries = cache->snapshot();
+    if (entries.empty())
+      return nullptr;
+    return cache->open(entries.front().info.bus_number, entries.front().info.port_path);
+  }
+
+  // Need the location of the device libusb would pick to assign it to an event loop
+  std::uint8_t bus_number = 0;
+  std::uint8_t ports[7];
+  int num_ports = -1;
+  for_each_device([&](libusb_device* dev, const libusb_device_descriptor& desc) {
+    if (num_ports >= 0 || desc.idVendor != vendor_id || desc.idProduct != product_id)
+      return;
+    bus_number = ::libusb_get_bus_number(dev);
+    num_ports = std::max(::libusb_get_port_numbers(dev, ports, static_cast<int>(std::size(ports))), 0);
+  });
+  if (num_ports < 0)
+    return nullptr;
+
+  const auto index = assign_event_loop(bus_number, std::span<const std::uint8_t>(ports, num_ports));
+  return ::libusb_open_device_with_vid_pid(event_loops_[index].context, vendor_id, product_id);
+}
+
+libusb_device_handle* usb_context::wrap_device(std::intptr_t fd)
+{
+  // We can't tell the bus before wrapping, so just pick the next event loop
+  libusb_device_handle* handle = nullptr;
+  const auto ret = ::libusb_wrap_sys_device(event_loops_[assign_event_loop(0)].context, fd, &handle);
+  if (ret != LIBUSB_SUCCESS) {
+    PSEYE_LOG_ERROR("failed to wrap device fd {}: {} {}", fd, ret, ::libusb_error_name(ret));
+    throw usb_error(ret, "failed to wrap USB device");
+  }
+  return handle;
+}
+
+std::size_t usb_context::assign_event_loop(std::uint8_t bus_number)
+{
+  if (event_loops_.size() == 1)
+    return 0;
+
+  std::lock_guard lock(assignment_mutex_);
+  return assign_event_loop_locked(bus_number);
+}
+
+std::size_t usb_context::assign_event_loop(std::uint8_t bus_number, std::span<const std::uint8_t> port_path)
+{
+  if (event_loops_.size() == 1)
+    return 0;
+
+  std::vector<std::uint8_t> location;
+  location.reserve(port_path.size() + 1);
+  location.push_back(bus_number);
+  location.insert(location.end(), port_path.begin(), port_path.end());
+
+  std::lock_guard lock(assignment_mutex_);
+  const auto it = std::find_if(port_event_loops_.begin(), port_event_loops_.end(),
+                               [&location](const auto& entry) { return entry.first == location; });
+  if (it != port_event_loops_.end())
+    return it->second;
+
+  const auto index = assign_event_loop_locked(bus_number);
+  port_event_loops_.emplace_back(std::move(location), index);
+  return index;
+}
+
+std::size_t usb_context::assign_event_loop_locked(std::uint8_t bus_number)
+{
+  if (options_.assignment == usb_event_loop_assignment::per_bus) {
+    const auto it = std::find_if(bus_event_loops_.begin(), bus_event_loops_.end(),
+                                 [bus_number](const auto& entry) { return entry.first == bus_number; });
+    if (it != bus_event_loops_.end())
+      return it->second;
+  }
+
+  const auto index = next_event_loop_;
+  next_event_loop_ = (next_event_loop_ + 1) % event_loops_.size();
+  if (options_.assignment == usb_event_loop_assignment::per_bus) {
+    bus_event_loops_.emplace_back(bus_number, index);
+    PSEYE_LOG_DEBUG("bus {} uses event loop {}", bus_number, index);
+  }
+  return index;
 }
 
-void usb_context::for_each_device_aux(void (*cb)(void* ctx, libusb_device* dev, const libusb_device_descriptor& desc),
+std::vector<usb_pollfd> usb_context::pollfds() const
+{
+  std::vector<usb_pollfd> fds;
+  for (const auto& loop : event_loops_) {
+    const libusb_pollfd** loop_fds = ::libusb_get_pollfds(loop.context);
+    if (!loop_fds)
+      continue;
+
+    for (const libusb_pollfd** fd = loop_fds; *fd; ++fd)
+      fds.push_back({(*fd)->fd, (*fd)->events});
+    ::libusb_free_pollfds(loop_fds);
+  }
+  return fds;
+}
+
+void usb_context::set_pollfd_handlers(pollfd_added_handler added, pollfd_removed_handler removed, void* ctx)
+{
+  pollfd_added_ = added;
+  pollfd_removed_ = removed;
+  pollfd_ctx_ = ctx;
+  for (const auto& loop : event_loops_) {
+    if (added)
+      ::libusb_set_pollfd_notifiers(loop.context, &usb_context::on_pollfd_added, &usb_context::on_pollfd_removed,
+                                    this);
+    else
+      ::libusb_set_pollfd_notifiers(loop.context, nullptr, nullptr, nullptr);
+  }
+}
+
+void usb_context::on_pollfd_added(int fd, short events, void* user_data)
+{
+  const auto self = static_cast<usb_context*>(user_data);
+  self->pollfd_added_(self->pollfd_ctx_, fd, events);
+}
+
+void usb_context::on_pollfd_removed(int fd, void* user_data)
+{
+  const auto self = static_cast<usb_context*>(user_data);
+  if (self->pollfd_removed_)
+    self->pollfd_removed_(self->pollfd_ctx_, fd);
+}
+
+std::optional<std::chrono::microseconds> usb_context::next_timeout() const
+{
+  std::optional<std::chrono::microseconds> timeout;
+  for (const auto& loop : event_loops_) {
+    timeval tv;
+    if (::libusb_get_next_timeout(loop.context, &tv) != 1)
+      continue; // none pending (or an error, which handle_events will run into as well)
+
+    const auto loop_timeout = std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+    if (!timeout || loop_timeout < *timeout)
+      timeout = loop_timeout;
+  }
+  return timeout;
+}
+
+void usb_context::handle_events_nonblocking()
+{
+  timeval tv{};
+  for (const auto& loop : event_loops_) {
+    const auto ret = ::libusb_handle_events_timeout_completed(loop.context, &tv, NULL);
+    if (ret != LIBUSB_SUCCESS && ret != LIBUSB_ERROR_INTERRUPTED)
+      PSEYE_LOG_ERROR("failed to handle USB events: {} {}", ret, ::libusb_error_name(ret));
+  }
+}
+
+int usb_context::add_hotplug_handler(std::uint16_t vendor_id,
+                                     std::uint16_t product_id,
+                                     hotplug_handler handler,
+                                     void* ctx)
+{
+  if (!::libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+    PSEYE_LOG_INFO("hotplug events are not supported on this platform");
+    return 0;
+  }
+
+  auto registration = std::make_unique<usb_hotplug_registration>();
+  registration->handler = handler;
+  registration->ctx = ctx;
+
+  std::lock_guard lock(hotplug_mutex_);
+  const auto ret = ::libusb_hotplug_register_callback(
+      event_loops_.front().context,
+      static_cast<libusb_hotplug_event>(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+      LIBUSB_HOTPLUG_NO_FLAGS, vendor_id, product_id, LIBUSB_HOTPLUG_MATCH_ANY, on_hotplug, registration.get(),
+      &registration->handle);
+  if (ret != LIBUSB_SUCCESS) {
+    PSEYE_LOG_ERROR("failed to register hotplug callback: {} {}", ret, ::libusb_error_name(ret));
+    return 0;
+  }
+
+  const int id = registration->handle;
+  hotplug_registrations_.push_back(std::move(registration));
+  return id;
+}
+
+void usb_context::remove_hotplug_handler(int id)
+{
+  std::lock_guard lock(hotplug_mutex_);
+  const auto it = std::find_if(hotplug_registrations_.begin(), hotplug_registrations_.end(),
+                               [id](const auto& registration) { return registration->handle == id; });
+  if (it == hotplug_registrations_.end())
+    return;
+
+  ::libusb_hotplug_deregister_callback(event_loops_.front().context, (*it)->handle);
+  hotplug_registrations_.erase(it);
+}
+
+void usb_context::for_each_device_aux(std::size_t event_loop,
+                                      void (*cb)(void* ctx, libusb_device* dev, const libusb_device_descriptor& desc),
                                       void* ctx)
 {
   libusb_device** devs;
-  const auto res = ::libusb_get_device_list(usb_context_, &devs);
+  const auto res = ::libusb_get_device_list(event_loops_.at(event_loop).context, &devs);
   if (res < 0) {
     PSEYE_LOG_ERROR("failed to enumerate USB devices: {} {}", res, ::libusb_error_name(res));
     return;
@@ -90,23 +324,34 @@ void usb_context::for_each_device_aux(void (*cb)(void* ctx, libusb_device* dev,
   ::libusb_free_device_list(devs, true);
 }
 
-void usb_context::run_event_loop() const
+void usb_context::run_event_loop(std::size_t index) const
 {
-  PSEYE_LOG_DEBUG("entering usb context event loop");
+  PSEYE_LOG_DEBUG("entering usb context event loop {}", index);
+  libusb_context* const context = event_loops_[index].context;
+  if (event_loops_.size() == 1) {
+    configure_current_thread(options_.event_thread);
+  } else {
+    thread_options thread = options_.event_thread;
+    thread.name += "-" + std::to_string(index);
+    if (!thread.cpu_affinity.empty())
+      thread.cpu_affinity = {options_.event_thread.cpu_affinity[index % options_.event_thread.cpu_affinity.size()]};
+    configure_current_thread(thread);
+  }
 
   timeval tv;
   tv.tv_sec = 0;
-  tv.tv_usec = 25 * 1000;
+  tv.tv_usec = options_.busy_poll ? 0 : 25 * 1000;
   while (!exit_requested_) {
-    libusb_handle_events_timeout_completed(usb_context_, &tv, NULL);
+    libusb_handle_events_timeout_completed(context, &tv, NULL);
   }
 
-  PSEYE_LOG_DEBUG("exiting usb context event loop");
+  PSEYE_LOG_DEBUG("exiting usb context event loop {}", index);
 }
 
 const libusb_endpoint_descriptor* find_endpoint(libusb_config_descriptor* config,
                                                 std::uint8_t interface_index,
-                                                libusb_transfer_type type)
+                                                libusb_transfer_type type,
+                                                std::uint8_t* alternate_setting)
 {
   for (int iface_idx = 0; iface_idx < config->bNumInterfaces; iface_idx++) {
     const libusb_interface* iface = &config->interface[iface_idx];
@@ -117,8 +362,11 @@ const libusb_endpoint_descriptor* find_endpoint(libusb_config_descriptor* config
 
       for (int ep_idx = 0; ep_idx < altsetting->bNumEndpoints; ep_idx++) {
         const libusb_endpoint_descriptor* ep = &altsetting->endpoint[ep_idx];
-        if ((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == type && ep->wMaxPacketSize != 0)
+        if ((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == type && ep->wMaxPacketSize != 0) {
+          if (alternate_setting)
+            *alternate_setting = altsetting->bAlternateSetting;
           return ep;
+        }
       }
     }
   }
@@ -0,0 +1,214 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/usb_stream_recording.hpp"
+
+#include "pseye/log.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+PSEYE_NS_BEGIN
+
+namespace
+{
+
+inline constexpr char file_magic[8] = {'P', 'S', 'E', 'Y', 'E', 'U', 'S', 'B'};
+inline constexpr std::uint32_t file_version = 1;
+// the magic, followed by version, payload_size, width, height, format and rate
+inline constexpr std::size_t file_header_size = sizeof(file_magic) + 6 * sizeof(std::uint32_t);
+inline constexpr std::size_t record_header_size = sizeof(std::uint64_t) + sizeof(std::uint32_t);
+inline constexpr std::size_t file_buffer_size = 1024 * 1024;
+
+template <typename T>
+void put(std::uint8_t*& out, T value)
+{
+  // NOTE: all our targets are little-endian
+  std::memcpy(out, &value, sizeof(value));
+  out += sizeof(value);
+}
+
+template <typename T>
+T get(const std::uint8_t*& in)
+{
+  T value;
+  std::memcpy(&value, in, sizeof(value));
+  in += sizeof(value);
+  return value;
+}
+
+[[noreturn]] void throw_file_error(const std::string& message)
+{
+  throw std::system_error(errno, std::generic_category(), message);
+}
+
+} // namespace
+
+usb_stream_recorder::usb_stream_recorder(const std::string& filename)
+  : file_(std::fopen(filename.c_str(), "wb"))
+{
+  if (!file_)
+    throw_file_error("failed to create recording " + filename);
+  std::setvbuf(file_, nullptr, _IOFBF, file_buffer_size);
+}
+
+usb_stream_recorder::~usb_stream_recorder()
+{
+  std::fclose(file_);
+}
+
+void usb_stream_recorder::begin(const usb_stream_header& header)
+{
+  if (has_header_)
+    return;
+
+  std::uint8_t buf[file_header_size];
+  std::uint8_t* out = buf;
+  std::memcpy(out, file_magic, sizeof(file_magic));
+  out += sizeof(file_magic);
+  put<std::uint32_t>(out, file_version);
+  put<std::uint32_t>(out, header.payload_size);
+  put<std::uint32_t>(out, header.width);
+  put<std::uint32_t>(out, header.height);
+  put<std::uint32_t>(out, static_cast<std::uint32_t>(header.format));
+  put<std::uint32_t>(out, header.rate);
+  if (std::fwrite(buf, sizeof(buf), 1, file_) != 1)
+    throw_file_error("failed to write recording header");
+  has_header_ = true;
+}
+
+void usb_stream_recorder::write(clock::time_point completion_time, std::span<const std::uint8_t> data)
+{
+  if (first_completion_ == clock::time_point{})
+    first_completion_ = completion_time;
+
+  std::uint8_t buf[record_header_size];
+  std::uint8_t* out = buf;
+  put<std::uint64_t>(out, std::chrono::duration_cast<std::chrono::nanoseconds>(completion_time - first_completion_).count());
+  put<std::uint32_t>(out, static_cast<std::uint32_t>(data.size()));
+
+  // Don't throw on the data path, a truncated recording is still useful
+  if (std::fwrite(buf, sizeof(buf), 1, file_) != 1 || std::fwrite(data.data(), 1, data.size(), file_) != data.size())
+    PSEYE_LOG_ERROR("failed to write {} bytes to recording: {}", data.size(), std::strerror(errno));
+}
+
+std::shared_ptr<const usb_stream_recording> usb_stream_recording::load(const std::string& filename)
+{
+  std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::fopen(filename.c_str(), "rb"), &std::fclose);
+  if (!file)
+    throw_file_error("failed to open recording " + filename);
+
+  auto recording = std::make_shared<usb_stream_recording>();
+
+  std::uint8_t header[file_header_size];
+  if (std::fread(header, sizeof(header), 1, file.get()) != 1 ||
+      std::memcmp(header, file_magic, sizeof(file_magic)) != 0)
+    throw std::runtime_error("not a recording: " + filename);
+
+  const std::uint8_t* in = header + sizeof(file_magic);
+  if (get<std::uint32_t>(in) != file_version)
+    throw std::runtime_error("unsupported recording version: " + filename);
+  recording->header_.payload_size = get<std::uint32_t>(in);
+  recording->header_.width = get<std::uint32_t>(in);
+  recording->header_.height = get<std::uint32_t>(in);
+  recording->header_.format = static_cast<pixel_format>(get<std::uint32_t>(in));
+  recording->header_.rate = get<std::uint32_t>(in);
+
+  while (true) {
+    std::uint8_t record_header[record_header_size];
+    if (std::fread(record_header, sizeof(record_header), 1, file.get()) != 1)
+      break;
+
+    in = record_header;
+    record r;
+    r.completion_time = std::chrono::nanoseconds(get<std::uint64_t>(in));
+    r.offset = recording->data_.size();
+    r.length = get<std::uint32_t>(in);
+
+    recording->data_.resize(r.offset + r.length);
+    if (std::fread(recording->data_.data() + r.offset, 1, r.length, file.get()) != r.length) {
+      PSEYE_LOG_WARNING("recording {} is truncated after {} records", filename, recording->records_.size());
+      recording->data_.resize(r.offset);
+      break;
+    }
+
+    recording->records_.push_back(r);
+    recording->max_record_size_ = std::max<std::size_t>(recording->max_record_size_, r.length);
+  }
+
+  PSEYE_LOG_DEBUG("loaded {} records with {} bytes from {}", recording->records_.size(), recording->data_.size(),
+                  filename);
+  return recording;
+}
+
+usb_stream_player::usb_stream_player(std::shared_ptr<const usb_stream_recording> recording,
+                                     data_handler handler,
+                                     void* ctx)
+  : recording_(std::move(recording))
+  , handler_(handler)
+  , handler_ctx_(ctx)
+  , transfer_buffer_(recording_->max_record_size())
+{
+}
+
+void usb_stream_player::start(const usb_replay_options& options)
+{
+  stop();
+  stop_requested_ = false;
+  thread_ = std::thread(&usb_stream_player::run, this, options);
+}
+
+void usb_stream_player::stop()
+{
+  stop_requested_ = true;
+  wait();
+}
+
+void usb_stream_player::wait()
+{
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void usb_stream_player::run(usb_replay_options options)
+{
+  using clock = std::chrono::steady_clock;
+
+  const auto records = recording_->records();
+  if (records.empty())
+    return;
+
+  // Keep the recorded spacing across loops as well
+  const auto loop_duration = records.back().completion_time + (records.back().completion_time / records.size());
+
+  auto base_time = clock::now();
+  do {
+    for (const auto& r : records) {
+      if (stop_requested_)
+        return;
+
+      if (options.real_time)
+        std::this_thread::sleep_until(base_time + r.completion_time);
+
+      const auto data = recording_->data(r);
+      std::memcpy(transfer_buffer_.data(), data.data(), data.size());
+      handler_(handler_ctx_, std::span(transfer_buffer_.data(), data.size()));
+      num_replayed_.fetch_add(1, std::memory_order_relaxed);
+    }
+    base_time += std::chrono::duration_cast<clock::duration>(loop_duration);
+  } while (options.loop);
+}
+
+PSEYE_NS_END
@@ -18,6 +18,9 @@
 
 #include <libusb.h>
 
+#include <algorithm>
+#include <thread>
+
 PSEYE_NS_BEGIN
 
 void free_libusb_transfer::operator()(libusb_transfer* transfer) const
@@ -26,128 +29,522 @@ void free_libusb_transfer::operator()(libusb_transfer* transfer) const
   ::libusb_free_transfer(transfer);
 }
 
-bool usb_transfer_controller::start(libusb_device_handle* handle,
-                                    std::uint8_t endpoint,
-                                    std::size_t num_transfers,
-                                    std::size_t transfer_size)
+bool usb_transfer_controller::start(libusb_device_handle* handle, const usb_transfer_settings& settings)
 {
-  ::libusb_clear_halt(handle, endpoint);
+  ::libusb_clear_halt(handle, settings.endpoint);
+
+  // The tuner can't re-layout isochronous packets
+  tuning_enabled_ = settings.tuning.enabled && settings.num_iso_packets == 0;
+  if (settings.tuning.enabled && !tuning_enabled_)
+    PSEYE_LOG_WARNING("transfer auto-tuning is only supported for bulk endpoints");
+
+  // With tuning enabled, we allocate for the worst case up front and vary the submitted length & count
+  std::size_t num_slots = settings.num_transfers;
+  std::size_t slot_size = settings.transfer_size;
+  std::size_t num_transfers = settings.num_transfers;
+  std::size_t transfer_size = settings.transfer_size;
+  if (tuning_enabled_) {
+    tuner_.reset(settings.tuning, settings.num_transfers, settings.transfer_size);
+    num_slots = settings.tuning.max_transfers;
+    slot_size = std::max(settings.tuning.max_transfer_size, settings.transfer_size);
+    num_transfers = tuner_.num_transfers();
+    transfer_size = tuner_.transfer_size();
+  }
+
+  handoff_enabled_ = settings.num_spare_buffers != 0 && settings.num_iso_packets == 0;
+  if (settings.num_spare_buffers != 0 && !handoff_enabled_)
+    PSEYE_LOG_WARNING("transfer buffer hand-off is only supported for bulk endpoints");
+  const auto num_spare_buffers = handoff_enabled_ ? settings.num_spare_buffers : 0;
 
-  std::lock_guard lock(active_transfers_mutex_);
-  transfers_.resize(num_transfers);
-  transfer_buffer_.reset(new std::uint8_t[transfer_size * num_transfers]);
+  handle_ = handle;
+  endpoint_ = settings.endpoint;
+  is_iso_ = settings.num_iso_packets != 0;
+  num_transfers_ = settings.num_transfers;
 
-  for (int index = 0; index < num_transfers; ++index) {
-    transfers_[index].reset(::libusb_alloc_transfer(0));
-    ::libusb_fill_bulk_transfer(
-        transfers_[index].get(), handle, endpoint, &transfer_buffer_[index * transfer_size], transfer_size,
-        [](libusb_transfer* transfer) {
-          const auto self = static_cast<usb_transfer_controller*>(transfer->user_data);
-          self->process_done(transfer);
-        },
-        this, 0);
+  stop_requested_ = false;
+  slots_.clear();
+  slots_.resize(num_slots);
+  parked_transfers_.clear();
+  parked_transfers_.reserve(num_slots);
+  allocate_buffer(handle, slot_size * (num_slots + num_spare_buffers), settings.buffer_allocation);
 
-    const auto res = ::libusb_submit_transfer(transfers_[index].get());
+  // Spare buffers live behind the ones initially assigned to the transfer slots
+  free_buffers_.reset(num_slots + num_spare_buffers);
+  for (std::size_t index = 0; index < num_spare_buffers; ++index)
+    free_buffers_.try_push(&transfer_buffer_[(num_slots + index) * slot_size]);
+  num_dropped_transfers_ = 0;
+  num_bad_iso_packets_ = 0;
+  telemetry_.reset(std::chrono::steady_clock::now());
+
+  const auto num_iso_packets = static_cast<int>(settings.num_iso_packets);
+  const auto on_transfer_done = [](libusb_transfer* transfer) {
+    static_cast<transfer_slot*>(transfer->user_data)->owner->process_done(transfer);
+  };
+
+  for (std::size_t index = 0; index < num_slots; ++index) {
+    auto& slot = slots_[index];
+    slot.owner = this;
+    slot.index = index;
+    slot.transfer.reset(::libusb_alloc_transfer(num_iso_packets));
+
+    const auto transfer = slot.transfer.get();
+    const auto buffer = &transfer_buffer_[index * slot_size];
+    const auto length = static_cast<int>(transfer_size);
+    if (num_iso_packets == 0) {
+      ::libusb_fill_bulk_transfer(transfer, handle, settings.endpoint, buffer, length, on_transfer_done, &slot, 0);
+    } else {
+      ::libusb_fill_iso_transfer(transfer, handle, settings.endpoint, buffer, length, num_iso_packets,
+                                 on_transfer_done, &slot, 0);
+      ::libusb_set_iso_packet_lengths(transfer, length / num_iso_packets);
+    }
+  }
+
+  max_recovery_attempts_ = settings.max_recovery_attempts;
+  recovering_ = false;
+  // A pause doesn't outlive stop(), otherwise every completion would be parked right away
+  paused_ = false;
+  recovery_attempts_ = 0;
+  device_lost_ = false;
+  device_lost_reported_ = false;
+  recovery_thread_ = std::thread(&usb_transfer_controller::run_recovery, this);
+
+  for (std::size_t index = 0; index < num_slots; ++index) {
+    const auto transfer = slots_[index].transfer.get();
+    if (index >= num_transfers) {
+      parked_transfers_.push_back(transfer);
+      continue;
+    }
+
+    const auto res = submit_transfer(transfer);
     if (res != LIBUSB_SUCCESS) {
       // We might just have exhausted the number of possible transfers, just stop and keep the existing ones going!
       PSEYE_LOG_WARNING("failed to submit transfer {}: {} {}", index, res, ::libusb_error_name(res));
       break; // don't submit more!
     }
-
-    num_active_transfers_++;
   }
 
-  PSEYE_LOG_DEBUG("started {} active transfers with {} bytes each on {}", num_active_transfers_, transfer_size,
-                  endpoint);
-  return num_active_transfers_ > 0; // we're good if we got one at least!
+  const std::uint32_t num_started = num_active_transfers_;
+  PSEYE_LOG_DEBUG("started {} active transfers with {} bytes ({} iso packets, {} memory) each on {}", num_started,
+                  transfer_size, settings.num_iso_packets,
+                  buffer_allocation_ == usb_buffer_allocation::device_memory ? "device" : "heap", settings.endpoint);
+  return num_started > 0; // we're good if we got one at least!
 }
 
 void usb_transfer_controller::stop()
 {
-  std::unique_lock lock(active_transfers_mutex_);
-  if (num_active_transfers_ == 0)
-    return;
+  stop_requested_ = true;
+  recovery_signal_.fetch_add(1, std::memory_order_release);
+  recovery_signal_.notify_one();
 
-  // Cancel any pending transfers
-  for (const auto& transfer : transfers_) {
-    if (transfer)
-      ::libusb_cancel_transfer(transfer.get());
+  // Cancel any pending transfers; ones that already finished for good just report LIBUSB_ERROR_NOT_FOUND
+  for (const auto& slot : slots_) {
+    if (slot.transfer)
+      ::libusb_cancel_transfer(slot.transfer.get());
   }
 
+  // A recovery in progress might still resubmit (and cancel) its refill, so it has to be done before we wait
+  if (recovery_thread_.joinable())
+    recovery_thread_.join();
+
   // Wait for cancellation to finish
-  transfer_done_condition_.wait(lock, [this]() {
-    return num_active_transfers_ == 0;
-  });
+  for (auto active = num_active_transfers_.load(); active != 0; active = num_active_transfers_.load())
+    num_active_transfers_.wait(active);
 
-  transfers_.clear();
+  slots_.clear();
 }
 
-void usb_transfer_controller::free_transfer(libusb_transfer* transfer)
+void usb_transfer_controller::pause()
 {
-  std::lock_guard lock(active_transfers_mutex_);
-  --num_active_transfers_;
+  if (paused_.exchange(true))
+    return;
 
-  const auto it = std::find_if(std::begin(transfers_), std::end(transfers_), [transfer](const auto& p) {
-    return p.get() == transfer;
-  });
-  if (it != std::end(transfers_)) {
-    it->reset();
-  } else {
-    PSEYE_LOG_ERROR("transfer {} not found", static_cast<void*>(transfer));
+  // Completions park cancelled transfers while we're paused
+  for (const auto& slot : slots_) {
+    if (slot.transfer)
+      ::libusb_cancel_transfer(slot.transfer.get());
   }
+  for (auto active = num_active_transfers_.load(); active != 0; active = num_active_transfers_.load())
+    num_active_transfers_.wait(active);
+  PSEYE_LOG_DEBUG("paused endpoint {}, {} transfers parked", endpoint_, parked_transfers_.size());
+}
+
+void usb_transfer_controller::resume()
+{
+  std::vector<libusb_transfer*> refill;
+  {
+    std::lock_guard lock(parked_mutex_);
+    if (!paused_)
+      return;
+
+    telemetry_.record_resume(std::chrono::steady_clock::now());
+    paused_ = false;
+    // A recovery that raced the pause refills once the halt is cleared
+    if (recovering_)
+      return;
+
+    // Nothing is active, so the parked transfers are all ours
+    refill = take_refill();
+  }
+  submit_refill(refill);
+}
+
+usb_transfer_statistics usb_transfer_controller::statistics() const
+{
+  auto stats = telemetry_.snapshot(std::chrono::steady_clock::now(), !stop_requested_ && !paused_);
+  stats.in_flight = num_active_transfers_.load(std::memory_order_relaxed);
+  stats.num_dropped_transfers = num_dropped_transfers_.load(std::memory_order_relaxed);
+  stats.num_bad_iso_packets = num_bad_iso_packets_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+std::size_t usb_transfer_controller::deliver_iso_packets(libusb_transfer* transfer,
+                                                         data_handler handler,
+                                                         void* ctx,
+                                                         std::uint64_t& num_bad_packets)
+{
+  // Isochronous transfers carry one payload per packet, with possibly empty packets in-between.
+  // Failed packets are only counted, logging each one would flood the log (and stall the event thread) on a bad bus.
+  std::size_t received = 0;
+  for (int packet_id = 0; packet_id < transfer->num_iso_packets; ++packet_id) {
+    const auto& pkt = transfer->iso_packet_desc[packet_id];
+    if (pkt.status != LIBUSB_TRANSFER_COMPLETED) {
+      ++num_bad_packets;
+      continue;
+    }
+
+    received += pkt.actual_length;
+    if (pkt.actual_length != 0)
+      handler(ctx, std::span(::libusb_get_iso_packet_buffer_simple(transfer, packet_id), pkt.actual_length));
+  }
+  return received;
+}
 
-  transfer_done_condition_.notify_one();
+void usb_transfer_controller::allocate_buffer(libusb_device_handle* handle,
+                                              std::size_t size,
+                                              usb_buffer_allocation preferred)
+{
+  free_buffer();
+
+  if (preferred == usb_buffer_allocation::device_memory) {
+    transfer_buffer_ = ::libusb_dev_mem_alloc(handle, size);
+    if (transfer_buffer_) {
+      buffer_owner_ = handle;
+      transfer_buffer_size_ = size;
+      buffer_allocation_ = usb_buffer_allocation::device_memory;
+      return;
+    }
+    PSEYE_LOG_INFO("device memory unavailable, falling back to heap transfer buffers");
+  }
+
+  transfer_buffer_ = new std::uint8_t[size];
+  transfer_buffer_size_ = size;
+  buffer_allocation_ = usb_buffer_allocation::heap;
+}
+
+void usb_transfer_controller::free_buffer()
+{
+  if (!transfer_buffer_)
+    return;
+
+  if (buffer_allocation_ == usb_buffer_allocation::device_memory)
+    ::libusb_dev_mem_free(buffer_owner_, transfer_buffer_, transfer_buffer_size_);
+  else
+    delete[] transfer_buffer_;
+
+  buffer_owner_ = nullptr;
+  transfer_buffer_ = nullptr;
+  transfer_buffer_size_ = 0;
+}
+
+void usb_transfer_controller::retire_transfer()
+{
+  // The transfer itself stays allocated in its slot until stop()
+  if (num_active_transfers_.fetch_sub(1) == 1)
+    num_active_transfers_.notify_all();
+}
+
+int usb_transfer_controller::submit_transfer(libusb_transfer* transfer)
+{
+  // count it before submitting, the completion might race us
+  num_active_transfers_++;
+  const auto res = ::libusb_submit_transfer(transfer);
+  if (res != LIBUSB_SUCCESS)
+    retire_transfer();
+  return res;
+}
+
+void usb_transfer_controller::resubmit_parked_transfers()
+{
+  const auto size = static_cast<int>(tuner_.transfer_size());
+  while (!parked_transfers_.empty() && num_active_transfers_ < tuner_.num_transfers()) {
+    const auto transfer = parked_transfers_.back();
+    transfer->length = size;
+    if (submit_transfer(transfer) != LIBUSB_SUCCESS)
+      break; // keep it parked, maybe next time
+    parked_transfers_.pop_back();
+
+    // Same as for the completed transfer in process_done()
+    if (stop_requested_ || paused_)
+      ::libusb_cancel_transfer(transfer);
+  }
+}
+
+std::vector<libusb_transfer*> usb_transfer_controller::take_refill()
+{
+  // Leave the surplus parked, the tuner might ask for it later
+  const std::size_t depth = tuning_enabled_ ? tuner_.num_transfers() : num_transfers_;
+  const auto count = std::min(depth, parked_transfers_.size());
+  std::vector<libusb_transfer*> refill(parked_transfers_.end() - count, parked_transfers_.end());
+  parked_transfers_.resize(parked_transfers_.size() - count);
+  return refill;
+}
+
+void usb_transfer_controller::submit_refill(const std::vector<libusb_transfer*>& refill)
+{
+  for (const auto transfer : refill) {
+    if (tuning_enabled_)
+      transfer->length = static_cast<int>(tuner_.transfer_size());
+
+    const auto res = submit_transfer(transfer);
+    if (res != LIBUSB_SUCCESS) {
+      PSEYE_LOG_WARNING("failed to resubmit parked transfer: {} {}", res, ::libusb_error_name(res));
+      continue;
+    }
+
+    // stop() or pause() might have missed this transfer, a paused one ends up parked again
+    if (stop_requested_ || paused_)
+      ::libusb_cancel_transfer(transfer);
+  }
+}
+
+void usb_transfer_controller::park_transfer(libusb_transfer* transfer)
+{
+  parked_transfers_.push_back(transfer);
+  retire_transfer();
+}
+
+void usb_transfer_controller::begin_recovery(libusb_transfer* transfer)
+{
+  parked_transfers_.push_back(transfer);
+
+  if (!recovering_.exchange(true)) {
+    telemetry_.record_recovery();
+    recovery_status_ = transfer->status;
+    halt_time_ = std::chrono::steady_clock::now();
+
+    // The endpoint is halted, none of the other transfers is going to complete normally
+    for (const auto& slot : slots_) {
+      if (slot.transfer.get() != transfer)
+        ::libusb_cancel_transfer(slot.transfer.get());
+    }
+
+    recovery_signal_.fetch_add(1, std::memory_order_release);
+    recovery_signal_.notify_one();
+  }
+
+  // The recovery thread takes over once the last transfer is retired
+  retire_transfer();
+}
+
+void usb_transfer_controller::run_recovery()
+{
+  auto signal = recovery_signal_.load(std::memory_order_acquire);
+  while (!stop_requested_) {
+    if (recovering_ && !device_lost_)
+      recover();
+
+    if (device_lost_ && !device_lost_reported_) {
+      PSEYE_LOG_ERROR("device on endpoint {} is gone", endpoint_);
+      device_lost_reported_ = true;
+      usb_recovery_info info;
+      report_recovery(usb_recovery_event::device_lost, info);
+    }
+
+    recovery_signal_.wait(signal, std::memory_order_acquire);
+    signal = recovery_signal_.load(std::memory_order_acquire);
+  }
+}
+
+void usb_transfer_controller::recover()
+{
+  // All transfers have been cancelled, wait for them to end up parked
+  for (auto active = num_active_transfers_.load(); active != 0; active = num_active_transfers_.load())
+    num_active_transfers_.wait(active);
+
+  usb_recovery_info info;
+  info.status = recovery_status_;
+  while (true) {
+    if (stop_requested_)
+      return;
+
+    info.attempt = recovery_attempts_.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (info.attempt > max_recovery_attempts_) {
+      PSEYE_LOG_ERROR("giving up on endpoint {} after {} recovery attempts", endpoint_, max_recovery_attempts_);
+      report_recovery(usb_recovery_event::failed, info);
+      return;
+    }
+    report_recovery(usb_recovery_event::halted, info);
+
+    // Isochronous endpoints can't halt
+    const int ret = is_iso_ ? LIBUSB_SUCCESS : ::libusb_clear_halt(handle_, endpoint_);
+    if (ret == LIBUSB_SUCCESS)
+      break;
+
+    PSEYE_LOG_WARNING("failed to clear halt on endpoint {}: {} {}", endpoint_, ret, ::libusb_error_name(ret));
+    if (ret == LIBUSB_ERROR_NO_DEVICE) {
+      report_recovery(usb_recovery_event::failed, info);
+      device_lost_ = true;
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10) * info.attempt);
+  }
+
+  report_recovery(usb_recovery_event::recovered, info);
+
+  std::vector<libusb_transfer*> refill;
+  {
+    std::lock_guard lock(parked_mutex_);
+    // From here on, completions are handled as usual again
+    recovering_ = false;
+    if (paused_) {
+      PSEYE_LOG_INFO("recovered endpoint {} after {} ms, paused", endpoint_,
+                     std::chrono::duration_cast<std::chrono::milliseconds>(info.downtime).count());
+      return; // resume() is going to refill
+    }
+    refill = take_refill();
+  }
+
+  PSEYE_LOG_INFO("recovered endpoint {} after {} ms, resubmitting {} transfers", endpoint_,
+                 std::chrono::duration_cast<std::chrono::milliseconds>(info.downtime).count(), refill.size());
+  submit_refill(refill);
+}
+
+void usb_transfer_controller::report_recovery(usb_recovery_event event, usb_recovery_info& info)
+{
+  info.event = event;
+  info.downtime = std::chrono::steady_clock::now() - halt_time_.load();
+  if (recovery_handler_)
+    recovery_handler_(recovery_handler_ctx_, info);
 }
 
 void usb_transfer_controller::process_done(libusb_transfer* transfer)
 {
-  bool resubmit = true;
+  const auto now = std::chrono::steady_clock::now();
+  std::size_t received = transfer->actual_length;
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    telemetry_.record_completion(now, transfer->status, 0);
 
   switch (transfer->status) {
     case LIBUSB_TRANSFER_COMPLETED:
+      if (tuning_enabled_) {
+        tuner_.record(now, transfer->actual_length, transfer->length);
+      }
+      // Data is flowing again, so the next halt starts with a fresh set of attempts
+      if (recovery_attempts_.load(std::memory_order_relaxed) != 0)
+        recovery_attempts_.store(0, std::memory_order_relaxed);
+
       if (transfer->num_iso_packets == 0) {
         // Bulk transfers only have one payload transfer
-        handler_(std::span(transfer->buffer, transfer->actual_length));
-      } else {
-        // TODO: test & implement iso transfer mode!
-        PSEYE_LOG_ERROR("completed isochronous transfer with {} bytes", transfer->actual_length);
-
-        for (int packet_id = 0; packet_id < transfer->num_iso_packets; ++packet_id) {
-          const auto& pkt = transfer->iso_packet_desc[packet_id];
-          if (pkt.status == LIBUSB_TRANSFER_COMPLETED) {
-            const auto pkt_buf = libusb_get_iso_packet_buffer_simple(transfer, packet_id);
-            handler_(std::span(transfer->buffer, transfer->actual_length));
-            continue;
+        if (!handoff_enabled_) {
+          handler_(handler_ctx_, std::span(transfer->buffer, transfer->actual_length));
+        } else if (transfer->actual_length != 0) {
+          // Swap in a spare buffer and give the filled one away; no spare means our consumer is too slow
+          std::uint8_t* spare;
+          if (free_buffers_.try_pop(spare)) {
+            handler_(handler_ctx_, std::span(transfer->buffer, transfer->actual_length));
+            transfer->buffer = spare;
+          } else {
+            num_dropped_transfers_.fetch_add(1, std::memory_order_relaxed);
+            PSEYE_DLOG_DEBUG("no spare transfer buffer, dropping {} bytes", transfer->actual_length);
           }
-          PSEYE_LOG_ERROR("bad iso packet: status {} {}", static_cast<int>(pkt.status),
-                          ::libusb_error_name(pkt.status));
         }
+      } else {
+        std::uint64_t num_bad_packets = 0;
+        received = deliver_iso_packets(transfer, handler_, handler_ctx_, num_bad_packets);
+        if (num_bad_packets != 0)
+          num_bad_iso_packets_.fetch_add(num_bad_packets, std::memory_order_relaxed);
       }
+      telemetry_.record_completion(now, transfer->status, received);
       break;
     case LIBUSB_TRANSFER_CANCELLED:
-    case LIBUSB_TRANSFER_ERROR:
-    case LIBUSB_TRANSFER_NO_DEVICE: {
+      // Cancelled by begin_recovery() or pause(), keep it for the refill
+      if ((recovering_ || paused_) && !stop_requested_) {
+        park_transfer(transfer);
+        return;
+      }
+      [[fallthrough]];
+    case LIBUSB_TRANSFER_NO_DEVICE:
       PSEYE_LOG_DEBUG("not retrying transfer: status {} {}", static_cast<int>(transfer->status),
                       ::libusb_error_name(transfer->status));
-      free_transfer(transfer);
-      resubmit = false;
-      break;
-    }
-    case LIBUSB_TRANSFER_TIMED_OUT:
+      // Let the recovery thread tell everyone, once
+      if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE && !device_lost_.exchange(true)) {
+        halt_time_ = now;
+        recovery_signal_.fetch_add(1, std::memory_order_release);
+        recovery_signal_.notify_one();
+      }
+      retire_transfer();
+      return;
+    case LIBUSB_TRANSFER_ERROR:
     case LIBUSB_TRANSFER_STALL:
     case LIBUSB_TRANSFER_OVERFLOW:
+      if (max_recovery_attempts_ != 0 && !stop_requested_) {
+        PSEYE_LOG_DEBUG("recovering from transfer status {} {}", static_cast<int>(transfer->status),
+                        ::libusb_error_name(transfer->status));
+        begin_recovery(transfer);
+        return;
+      }
+      if (transfer->status == LIBUSB_TRANSFER_ERROR) {
+        PSEYE_LOG_DEBUG("not retrying transfer: status {} {}", static_cast<int>(transfer->status),
+                        ::libusb_error_name(transfer->status));
+        retire_transfer();
+        return;
+      }
+      PSEYE_LOG_DEBUG("retrying transfer with: status {} {}", static_cast<int>(transfer->status),
+                      ::libusb_error_name(transfer->status));
+      break;
+    case LIBUSB_TRANSFER_TIMED_OUT:
       PSEYE_LOG_DEBUG("retrying transfer with: status {} {}", static_cast<int>(transfer->status),
                       ::libusb_error_name(transfer->status));
       break;
   }
 
-  if (resubmit) {
-    const int ret = ::libusb_submit_transfer(transfer);
-    if (ret != LIBUSB_SUCCESS) {
-      free_transfer(transfer);
-      PSEYE_LOG_ERROR("failed re-submit of transfer with: {} {}", ret, ::libusb_error_name(ret));
+  if (stop_requested_) {
+    retire_transfer();
+    return;
+  }
+
+  // Completions racing a recovery (or a pause) are held back until the halt is cleared
+  if (recovering_ || paused_) {
+    park_transfer(transfer);
+    return;
+  }
+
+  if (tuning_enabled_) {
+    // Shrink by parking transfers as they come in, grow by resubmitting parked ones
+    if (num_active_transfers_ > tuner_.num_transfers()) {
+      park_transfer(transfer);
+      return;
     }
+    transfer->length = static_cast<int>(tuner_.transfer_size());
+  }
+
+  // We're still counted as active, so just resubmit
+  const auto status = transfer->status;
+  const int ret = ::libusb_submit_transfer(transfer);
+  if (ret != LIBUSB_SUCCESS) {
+    PSEYE_LOG_ERROR("failed re-submit of transfer {} with: {} {}",
+                    static_cast<const transfer_slot*>(transfer->user_data)->index, ret, ::libusb_error_name(ret));
+    retire_transfer();
+    return;
   }
+  telemetry_.record_resubmit(status);
+
+  if (tuning_enabled_)
+    resubmit_parked_transfers();
+
+  // stop() or pause() might have missed this transfer while we were busy with it, a paused one ends up parked
+  if (stop_requested_ || paused_)
+    ::libusb_cancel_transfer(transfer);
 }
 
 PSEYE_NS_END
@@ -0,0 +1,141 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/usb_transfer_telemetry.hpp"
+
+#include <algorithm>
+#include <bit>
+
+PSEYE_NS_BEGIN
+
+namespace
+{
+
+inline constexpr auto rate_window = std::chrono::seconds(1);
+// LIBUSB_TRANSFER_COMPLETED, without dragging in libusb.h
+inline constexpr int status_completed = 0;
+
+std::size_t bucket(std::uint64_t value)
+{
+  return std::min<std::size_t>(std::bit_width(value), usb_histogram::num_buckets - 1);
+}
+
+} // namespace
+
+std::uint64_t usb_histogram::percentile(double fraction) const
+{
+  const auto limit = static_cast<std::uint64_t>(static_cast<double>(total()) * fraction);
+  std::uint64_t sum = 0;
+  for (std::size_t i = 0; i < num_buckets; ++i) {
+    sum += counts[i];
+    if (sum >= limit && sum != 0)
+      return i == 0 ? 0 : std::uint64_t{1} << i;
+  }
+  return 0;
+}
+
+std::uint64_t usb_histogram::total() const
+{
+  std::uint64_t sum = 0;
+  for (const auto count : counts)
+    sum += count;
+  return sum;
+}
+
+void usb_transfer_telemetry::reset(clock::time_point now)
+{
+  rate_window_start_ = now;
+  rate_window_bytes_ = 0;
+
+  start_time_ = now.time_since_epoch().count();
+  last_completion_ = now.time_since_epoch().count();
+  num_bytes_ = 0;
+  num_completions_ = 0;
+  bytes_per_second_ = 0;
+  for (auto& c : completion_interval_)
+    c = 0;
+  for (auto& c : actual_length_)
+    c = 0;
+  for (auto& c : completions_by_status_)
+    c = 0;
+  for (auto& c : resubmits_by_status_)
+    c = 0;
+  num_recoveries_ = 0;
+  longest_gap_ = 0;
+}
+
+void usb_transfer_telemetry::record_completion(clock::time_point now, int status, std::size_t actual_length)
+{
+  increment(completions_by_status_[index(status)]);
+  if (status != status_completed)
+    return;
+
+  const auto interval = now.time_since_epoch().count() - last_completion_.load(std::memory_order_relaxed);
+  last_completion_.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+  store_max(longest_gap_, interval);
+
+  const auto interval_us = std::chrono::duration_cast<std::chrono::microseconds>(clock::duration(interval)).count();
+  increment(completion_interval_[bucket(static_cast<std::uint64_t>(std::max<clock::rep>(interval_us, 0)))]);
+  increment(actual_length_[bucket(actual_length)]);
+  increment(num_bytes_, actual_length);
+  increment(num_completions_);
+
+  rate_window_bytes_ += actual_length;
+  const auto window = now - rate_window_start_;
+  if (window >= rate_window) {
+    bytes_per_second_.store(static_cast<double>(rate_window_bytes_) / std::chrono::duration<double>(window).count(),
+                            std::memory_order_relaxed);
+    rate_window_start_ = now;
+    rate_window_bytes_ = 0;
+  }
+}
+
+void usb_transfer_telemetry::record_resume(clock::time_point now)
+{
+  // No completions happen while paused, the rate window restarts as well
+  last_completion_.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+  rate_window_start_ = now;
+  rate_window_bytes_ = 0;
+}
+
+usb_transfer_statistics usb_transfer_telemetry::snapshot(clock::time_point now, bool streaming) const
+{
+  usb_transfer_statistics stats;
+  const auto start_time = start_time_.load(std::memory_order_relaxed);
+  const auto last_completion = last_completion_.load(std::memory_order_relaxed);
+  stats.elapsed = clock::duration(now.time_since_epoch().count() - start_time);
+  stats.num_bytes = num_bytes_.load(std::memory_order_relaxed);
+  stats.num_completions = num_completions_.load(std::memory_order_relaxed);
+
+  stats.bytes_per_second = bytes_per_second_.load(std::memory_order_relaxed);
+  if (stats.elapsed < rate_window && stats.elapsed.count() > 0)
+    stats.bytes_per_second = static_cast<double>(stats.num_bytes) / std::chrono::duration<double>(stats.elapsed).count();
+
+  for (std::size_t i = 0; i < usb_histogram::num_buckets; ++i) {
+    stats.completion_interval.counts[i] = completion_interval_[i].load(std::memory_order_relaxed);
+    stats.actual_length.counts[i] = actual_length_[i].load(std::memory_order_relaxed);
+  }
+  for (std::size_t i = 0; i < usb_transfer_statistics::num_statuses; ++i) {
+    stats.completions_by_status[i] = completions_by_status_[i].load(std::memory_order_relaxed);
+    stats.resubmits_by_status[i] = resubmits_by_status_[i].load(std::memory_order_relaxed);
+  }
+  stats.num_recoveries = num_recoveries_.load(std::memory_order_relaxed);
+
+  // The gap we're currently in counts too
+  const auto current_gap = streaming ? now.time_since_epoch().count() - last_completion : 0;
+  stats.longest_gap = clock::duration(std::max(longest_gap_.load(std::memory_order_relaxed), current_gap));
+  return stats;
+}
+
+PSEYE_NS_END
@@ -0,0 +1,157 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/usb_transfer_tuner.hpp"
+
+#include "pseye/log.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+PSEYE_NS_BEGIN
+
+namespace
+{
+
+std::size_t round_up(std::size_t value, std::size_t granularity)
+{
+  return (value + granularity - 1) / granularity * granularity;
+}
+
+} // namespace
+
+void usb_transfer_tuner::reset(const usb_transfer_tuning& tuning, std::size_t num_transfers, std::size_t transfer_size)
+{
+  tuning_ = tuning;
+  tuning_.granularity = std::max<std::size_t>(tuning_.granularity, 1);
+  tuning_.max_transfer_size = std::max(tuning_.max_transfer_size / tuning_.granularity, std::size_t{1}) *
+                              tuning_.granularity;
+  tuning_.max_transfers = std::max(tuning_.max_transfers, tuning_.min_transfers);
+
+  window_start_ = {};
+  last_completion_ = {};
+  window_max_interval_ = {};
+  window_bytes_ = 0;
+  window_capacity_ = 0;
+  window_completions_ = 0;
+
+  num_transfers_ = std::clamp(num_transfers, tuning_.min_transfers, tuning_.max_transfers);
+  transfer_size_ = std::clamp(round_up(transfer_size, tuning_.granularity), tuning_.granularity,
+                              tuning_.max_transfer_size);
+  bytes_per_second_ = 0;
+  mean_interval_us_ = 0;
+  max_interval_us_ = 0;
+  fill_ratio_ = 0;
+  adjustments_ = 0;
+}
+
+bool usb_transfer_tuner::record(clock::time_point now, std::size_t actual_length, std::size_t length)
+{
+  if (last_completion_ == clock::time_point{}) {
+    // the first completion only starts the clock
+    window_start_ = last_completion_ = now;
+    return false;
+  }
+
+  window_max_interval_ = std::max(window_max_interval_, now - last_completion_);
+  last_completion_ = now;
+  window_bytes_ += actual_length;
+  window_capacity_ += length;
+
+  if (++window_completions_ < tuning_.window)
+    return false;
+
+  const bool changed = decide(now);
+
+  window_start_ = now;
+  window_max_interval_ = {};
+  window_bytes_ = 0;
+  window_capacity_ = 0;
+  window_completions_ = 0;
+  return changed;
+}
+
+bool usb_transfer_tuner::decide(clock::time_point now)
+{
+  using namespace std::chrono;
+
+  const auto elapsed = now - window_start_;
+  const double seconds = duration<double>(elapsed).count();
+  if (seconds <= 0 || window_bytes_ == 0)
+    return false;
+
+  const double rate = static_cast<double>(window_bytes_) / seconds;
+  const double fill = static_cast<double>(window_bytes_) / static_cast<double>(window_capacity_);
+
+  bytes_per_second_.store(rate, std::memory_order_relaxed);
+  fill_ratio_.store(static_cast<float>(fill), std::memory_order_relaxed);
+  mean_interval_us_.store(duration_cast<microseconds>(elapsed / window_completions_).count(),
+                          std::memory_order_relaxed);
+  max_interval_us_.store(duration_cast<microseconds>(window_max_interval_).count(), std::memory_order_relaxed);
+
+  // Transfer length first: whole frames for throughput, the biggest fraction of a frame that fills up
+  // within |target_latency| otherwise.
+  std::size_t size;
+  if (tuning_.goal == usb_tuning_goal::throughput) {
+    size = tuning_.frame_size != 0 ? tuning_.frame_size : tuning_.max_transfer_size;
+  } else {
+    const auto latency_bytes = static_cast<std::size_t>(rate * duration<double>(tuning_.target_latency).count());
+    if (tuning_.frame_size != 0) {
+      size = tuning_.frame_size;
+      while (size > latency_bytes && size / 2 >= tuning_.granularity)
+        size /= 2;
+    } else {
+      size = latency_bytes;
+    }
+  }
+  size = std::clamp(round_up(size, tuning_.granularity), tuning_.granularity, tuning_.max_transfer_size);
+
+  // Then enough of them to cover our headroom, or the longest gap we've just seen - whatever is worse.
+  // Short transfers at the end of a frame mean we get less than |size| per completion.
+  const double covered_seconds =
+      std::max(duration<double>(tuning_.headroom).count(), duration<double>(window_max_interval_).count());
+  const double bytes_per_transfer = static_cast<double>(size) * std::clamp(fill, 0.1, 1.0);
+  auto depth = static_cast<std::size_t>(std::ceil(rate * covered_seconds / bytes_per_transfer)) + 1;
+  depth = std::clamp(depth, tuning_.min_transfers, tuning_.max_transfers);
+
+  // Grow right away, but shrink one step at a time to avoid flapping
+  const auto current_depth = num_transfers();
+  if (depth < current_depth)
+    depth = current_depth - 1;
+
+  if (depth == current_depth && size == transfer_size())
+    return false;
+
+  PSEYE_LOG_DEBUG("tuning transfers: {} x {} -> {} x {} ({:.0f} B/s, fill {:.2f}, max gap {}us)", current_depth,
+                  transfer_size(), depth, size, rate, fill, max_interval_us_.load(std::memory_order_relaxed));
+  num_transfers_.store(depth, std::memory_order_relaxed);
+  transfer_size_.store(size, std::memory_order_relaxed);
+  adjustments_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+usb_tuning_state usb_transfer_tuner::state() const
+{
+  usb_tuning_state state;
+  state.num_transfers = num_transfers();
+  state.transfer_size = transfer_size();
+  state.bytes_per_second = bytes_per_second_.load(std::memory_order_relaxed);
+  state.mean_interval = std::chrono::microseconds(mean_interval_us_.load(std::memory_order_relaxed));
+  state.max_interval = std::chrono::microseconds(max_interval_us_.load(std::memory_order_relaxed));
+  state.fill_ratio = fill_ratio_.load(std::memory_order_relaxed);
+  state.adjustments = adjustments_.load(std::memory_order_relaxed);
+  return state;
+}
+
+PSEYE_NS_END
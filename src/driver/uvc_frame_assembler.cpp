@@ -0,0 +1,205 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/uvc_frame_assembler.hpp"
+#include "pseye/driver/spsc_frame_buffer.hpp"
+#include "pseye/log.hpp"
+
+#include <algorithm>
+
+PSEYE_NS_BEGIN
+
+void uvc_frame_assembler::reset(spsc_frame_buffer* frame_buffer, std::uint32_t payload_size)
+{
+  processor_ = {};
+  frame_buffer_ = frame_buffer;
+  segmented_frames_ = nullptr;
+  pool_ = nullptr;
+  held_.clear();
+  payload_size_ = payload_size;
+  frame_sequence_ = 0;
+  rows_per_slice_ = 0;
+  slice_frame_ = 0;
+  published_rows_ = 0;
+  clock_.reset();
+  clock_uses_scr_ = false;
+}
+
+void uvc_frame_assembler::reset(segmented_frame_queue* frames,
+                                pinned_buffer_pool* pool,
+                                std::size_t frame_size,
+                                std::uint32_t payload_size)
+{
+  processor_ = {};
+  frame_buffer_ = nullptr;
+  segmented_frames_ = frames;
+  pool_ = pool;
+  frame_size_ = frame_size;
+  held_.clear();
+  payload_size_ = payload_size;
+  frame_sequence_ = 0;
+  rows_per_slice_ = 0;
+  slice_frame_ = 0;
+  published_rows_ = 0;
+  clock_.reset();
+  clock_uses_scr_ = false;
+}
+
+void uvc_frame_assembler::begin_frame()
+{
+  if (segmented_frames_)
+    processor_.set_segmented_frame(&segmented_frames_->writable_frame().segments, frame_size_);
+  else
+    processor_.set_frame(frame_buffer_->writable_frame());
+}
+
+void uvc_frame_assembler::publish_slices()
+{
+  if (processor_.frame_starts() != slice_frame_) {
+    slice_frame_ = processor_.frame_starts();
+    published_rows_ = 0;
+  }
+
+  const auto rows = processor_.frame_length() / slice_row_size_;
+  const auto complete_rows = rows - rows % rows_per_slice_;
+  if (complete_rows > published_rows_) {
+    frame_buffer_->publish_slice(slice_row_size_, published_rows_, complete_rows - published_rows_, frame_sequence_);
+    published_rows_ = complete_rows;
+  }
+}
+
+void uvc_frame_assembler::finish_frame(std::chrono::steady_clock::time_point completion_time)
+{
+  frame_metadata metadata{processor_.frame_pts(), completion_time, frame_sequence_++};
+  metadata.errors = processor_.frame_errors();
+  metadata.damaged_rows = processor_.damaged_rows();
+  metadata.scr = processor_.frame_scr();
+  metadata.sof = processor_.frame_sof();
+  metadata.first_payload_time = processor_.first_payload_time();
+
+  // The SCR is sampled closer to its transfer than the PTS, devices not sending one get the PTS correlated instead.
+  // Both have a different delay, so once we see an SCR we start over with SCRs only (frames without one are skipped).
+  if (completion_time.time_since_epoch().count() != 0) {
+    if (metadata.scr != 0 && !clock_uses_scr_) {
+      clock_.reset();
+      clock_uses_scr_ = true;
+    }
+    if (!clock_uses_scr_)
+      clock_.add(metadata.pts, completion_time);
+    else if (metadata.scr != 0)
+      clock_.add(metadata.scr, completion_time);
+    if (clock_.is_valid())
+      metadata.capture_time = clock_.to_host(metadata.pts);
+  }
+  if (!segmented_frames_) {
+    // Whatever didn't fill a whole slice goes out with the frame
+    if (rows_per_slice_ != 0) {
+      if (processor_.frame_starts() != slice_frame_) {
+        slice_frame_ = processor_.frame_starts();
+        published_rows_ = 0;
+      }
+      const auto num_rows = frame_buffer_->frame_size() / slice_row_size_;
+      if (num_rows > published_rows_)
+        frame_buffer_->publish_slice(slice_row_size_, published_rows_, num_rows - published_rows_, metadata.sequence);
+      published_rows_ = num_rows;
+    }
+    frame_buffer_->finish_writing(metadata);
+    return;
+  }
+
+  // The segments are in order, so they span the held buffers from the one containing the first segment onwards
+  auto& frame = segmented_frames_->writable_frame();
+  const auto first = frame.segments.empty() ? nullptr : frame.segments.front().data();
+  auto it = held_.begin();
+  while (it != held_.end() && !(first >= it->begin && first < it->end))
+    ++it;
+  for (; it != held_.end(); ++it) {
+    pool_->ref(it->pin);
+    frame.pins.push_back(it->pin);
+  }
+  // Salvaged frames might be short
+  frame.size = 0;
+  for (const auto& segment : frame.segments)
+    frame.size += segment.size();
+  frame.metadata = metadata;
+
+  // Our consumer fell behind, don't hold on to even more buffers
+  if (!segmented_frames_->finish_writing()) {
+    PSEYE_LOG_DEBUG("dropping frame {}, consumer is too slow", metadata.sequence);
+    segmented_frames_->discard_writable_frame();
+  }
+}
+
+void uvc_frame_assembler::put(std::span<const std::uint8_t> data, std::chrono::steady_clock::time_point completion_time)
+{
+  processor_.set_receive_time(completion_time);
+
+  // Process the input data in |payload_size_|-sized chunks
+  do {
+    std::size_t consumed = 0;
+    switch (processor_.put_batch(data, payload_size_, consumed)) {
+      case uvc_frame_processor::status::need_data:
+        // we successfully read all of it
+        if (rows_per_slice_ != 0)
+          publish_slices();
+        break;
+      case uvc_frame_processor::status::need_buffer:
+        // we might've been reset - just give it the current frame
+        begin_frame();
+        break;
+      case uvc_frame_processor::status::frame_complete:
+        finish_frame(completion_time);
+        begin_frame();
+        break;
+    }
+    data = data.subspan(consumed);
+  } while (!data.empty());
+}
+
+void uvc_frame_assembler::put_pinned(std::span<std::uint8_t> data,
+                                     std::chrono::steady_clock::time_point completion_time)
+{
+  buffer_pin pin;
+  if (!pool_->pin(data.data(), pin)) {
+    // The buffer is already back with the transport, so the frame in progress misses this data
+    PSEYE_LOG_DEBUG("no free pin for transfer buffer, dropping {} bytes", data.size());
+    release_pins();
+    return;
+  }
+
+  held_.push_back({data.data(), data.data() + data.size(), pin});
+  put(data, completion_time);
+
+  // Everything before the first segment of the frame in progress isn't needed anymore
+  const auto& segments = segmented_frames_->writable_frame().segments;
+  const auto first = segments.empty() ? nullptr : segments.front().data();
+  auto it = held_.begin();
+  while (it != held_.end() && !(first >= it->begin && first < it->end)) {
+    pool_->unref(it->pin);
+    ++it;
+  }
+  held_.erase(held_.begin(), it);
+}
+
+void uvc_frame_assembler::release_pins()
+{
+  for (const auto& held : held_)
+    pool_->unref(held.pin);
+  held_.clear();
+  if (segmented_frames_)
+    segmented_frames_->discard_writable_frame();
+  processor_.resync();
+}
+
+PSEYE_NS_END
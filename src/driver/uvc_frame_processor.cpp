@@ -16,6 +16,9 @@
 
 #include "pseye/log.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 PSEYE_NS_BEGIN
 
 inline constexpr std::uint8_t UVC_STREAM_FID = 1 << 0;
@@ -27,51 +30,119 @@ inline constexpr std::uint8_t UVC_STREAM_STI = 1 << 5;
 inline constexpr std::uint8_t UVC_STREAM_ERR = 1 << 6;
 inline constexpr std::uint8_t UVC_STREAM_EOH = 1 << 7;
 
+void uvc_frame_processor::append(const std::uint8_t* data, std::size_t size)
+{
+  if (segments_)
+    segments_->emplace_back(data, size);
+  else
+    std::memcpy(&current_frame_[frame_len_], data, size);
+  frame_len_ += size;
+}
+
+void uvc_frame_processor::mark_damaged(std::size_t begin, std::size_t end)
+{
+  if (row_size_ == 0 || begin >= end)
+    return;
+
+  const auto last_row = std::min((end - 1) / row_size_, max_frame_rows - 1);
+  for (auto row = begin / row_size_; row <= last_row; ++row)
+    damaged_rows_.set(row);
+}
+
 uvc_frame_processor::status uvc_frame_processor::put(std::span<const std::uint8_t> data)
 {
   if (data.empty())
     return status::need_data;
 
+  const bool salvage = row_size_ != 0;
   const auto header_len = data[0];
   if (header_len < 2 || data.size() < header_len) {
     PSEYE_LOG_ERROR("bad header: {} {}", header_len, data.size());
-    discard_frame_ = true;
+    if (salvage) {
+      // We don't know how much data we lost, so everything after this point is suspect
+      frame_errors_ |= frame_error_payload;
+      mark_damaged(frame_len_, frame_capacity_);
+    } else {
+      discard_frame_ = true;
+    }
     return status::need_data;
   }
 
+  std::uint8_t payload_errors = 0;
   if (0 != (data[1] & UVC_STREAM_ERR)) {
     PSEYE_LOG_ERROR("ERR bit in header: {:#02x}", data[1]);
-    discard_frame_ = true;
-    return status::need_data;
+    if (!salvage) {
+      discard_frame_ = true;
+      return status::need_data;
+    }
+    payload_errors |= frame_error_payload;
   }
 
-  if (0 == (data[1] & UVC_STREAM_PTS)) {
+  const bool has_pts = 0 != (data[1] & UVC_STREAM_PTS);
+  if (!has_pts) {
     PSEYE_LOG_ERROR("no PTS in header: {:#02x}", data[1]);
-    discard_frame_ = true;
-    return status::need_data;
+    if (!salvage) {
+      discard_frame_ = true;
+      return status::need_data;
+    }
+    payload_errors |= frame_error_missing_pts;
   }
 
-  const std::uint32_t this_pts = (data[5] << 24) | (data[4] << 16) | (data[3] << 8) | data[2];
+  // Salvage mode: a payload without PTS belongs to whatever frame its FID says
+  const std::uint32_t this_pts = has_pts ? (data[5] << 24) | (data[4] << 16) | (data[3] << 8) | data[2] : last_pts_;
   const std::uint8_t this_fid = (data[1] & UVC_STREAM_FID) ? 1 : 0;
 
-  if (this_pts != last_pts_ || this_fid != last_fid_) {
+  if (wait_for_fid_toggle_) {
+    // Anything before the toggle belongs to a frame we only got parts of
+    if (this_fid == last_fid_)
+      return status::need_data;
+    wait_for_fid_toggle_ = false;
+  }
+
+  if ((has_pts && pts_known_ && this_pts != last_pts_) || this_fid != last_fid_) {
     // Changed PTS or toggled frame ID bit means new frame!
     frame_len_ = 0;
+    ++frame_starts_;
     discard_frame_ = false;
     last_pts_ = this_pts;
     last_fid_ = this_fid;
-
-    if (current_frame_.empty())
+    frame_pts_ = this_pts;
+    pts_known_ = has_pts;
+    frame_scr_ = 0;
+    frame_sof_ = 0;
+    first_payload_time_ = receive_time_;
+    frame_errors_ = 0;
+    damaged_rows_.reset();
+    if (segments_)
+      segments_->clear();
+
+    if (!has_frame())
       return status::need_buffer;
-  } else if (0 != (data[1] & UVC_STREAM_EOF)) {
+  } else if (has_pts && !pts_known_) {
+    // The frame started with a payload lacking its PTS
+    last_pts_ = this_pts;
+    frame_pts_ = this_pts;
+    pts_known_ = true;
+  }
+
+  if (0 != (data[1] & UVC_STREAM_SCR) && header_len >= 12 && payload_errors == 0)
+    read_scr(data.data());
+
+  // A frame can consist of a single payload, so this isn't exclusive with the above
+  const auto to_copy = data.size() - header_len;
+  if (0 != (data[1] & UVC_STREAM_EOF)) {
     // After an EOF packet, we always begin a new frame.
     last_pts_ = 0;
 
-    // If this frame doesn't have the correct size, just drop it entirely!
-    if (frame_len_ + (data.size() - header_len) != current_frame_.size()) {
-      PSEYE_LOG_DEBUG("incorrect final frame size: {} + {} != {}", frame_len_, (data.size() - header_len),
-                      current_frame_.size());
-      discard_frame_ = true;
+    // If this frame doesn't have the correct size, just drop it entirely! (unless we're salvaging what we got)
+    if (frame_len_ + to_copy != frame_capacity_) {
+      PSEYE_LOG_DEBUG("incorrect final frame size: {} + {} != {}", frame_len_, to_copy, frame_capacity_);
+      if (!salvage) {
+        discard_frame_ = true;
+      } else if (frame_len_ + to_copy < frame_capacity_) {
+        frame_errors_ |= frame_error_short;
+        mark_damaged(frame_len_ + to_copy, frame_capacity_);
+      }
     }
   }
 
@@ -79,20 +150,103 @@ uvc_frame_processor::status uvc_frame_processor::put(std::span<const std::uint8_
   if (discard_frame_)
     return status::need_data;
 
-  const auto to_copy = data.size() - header_len;
-  if (frame_len_ + to_copy <= current_frame_.size()) {
-    std::memcpy(&current_frame_[frame_len_], &data[header_len], to_copy);
-    frame_len_ += to_copy;
+  if (payload_errors != 0) {
+    frame_errors_ |= payload_errors;
+    mark_damaged(frame_len_, frame_len_ + to_copy);
+  }
 
-    if (0 != (data[1] & UVC_STREAM_EOF)) {
-      frame_len_ = 0;
-      return status::frame_complete;
+  const auto fits = std::min<std::size_t>(to_copy, frame_capacity_ - frame_len_);
+  if (fits != to_copy) {
+    PSEYE_LOG_DEBUG("frame overflow: {} + {} > {}", frame_len_, to_copy, frame_capacity_);
+    if (!salvage) {
+      discard_frame_ = true;
+      return status::need_data;
     }
-  } else {
-    PSEYE_LOG_DEBUG("frame overflow: {} + {} > {}", frame_len_, to_copy, current_frame_.size());
-    discard_frame_ = true;
+    // No telling which rows the excess belongs to, so it's just dropped
+    frame_errors_ |= frame_error_overflow;
+  }
+
+  if (fits != 0)
+    append(&data[header_len], fits);
+
+  if (0 != (data[1] & UVC_STREAM_EOF)) {
+    frame_len_ = 0;
+    return status::frame_complete;
+  }
+  return status::need_data;
+}
+
+void uvc_frame_processor::read_scr(const std::uint8_t* header)
+{
+  // SCR follows the PTS: 32 bit source time clock & 11 bit USB frame number
+  frame_scr_ = (header[9] << 24) | (header[8] << 16) | (header[7] << 8) | header[6];
+  frame_sof_ = ((header[11] << 8) | header[10]) & 0x7ff;
+}
+
+std::size_t uvc_frame_processor::count_continuation_payloads(std::span<const std::uint8_t> data,
+                                                             std::size_t payload_size) const
+{
+  if (discard_frame_ || wait_for_fid_toggle_ || !has_frame() || last_pts_ == 0)
+    return 0;
+
+  // Full-sized payloads in the middle of our current frame, put() would just append their data
+  const std::uint8_t expected_flags = UVC_STREAM_PTS | last_fid_;
+  constexpr std::uint8_t checked_flags = UVC_STREAM_FID | UVC_STREAM_EOF | UVC_STREAM_PTS | UVC_STREAM_ERR;
+  const auto header_len = data[0];
+  if (header_len < 6 || header_len >= payload_size)
+    return 0;
+
+  std::size_t count = 0;
+  for (std::size_t offset = 0; offset + payload_size <= data.size(); offset += payload_size, ++count) {
+    const auto payload = &data[offset];
+    const std::uint32_t pts = (payload[5] << 24) | (payload[4] << 16) | (payload[3] << 8) | payload[2];
+    if (payload[0] != header_len || (payload[1] & checked_flags) != expected_flags || pts != last_pts_)
+      break;
   }
+  return count;
+}
+
+uvc_frame_processor::status uvc_frame_processor::put_batch(std::span<const std::uint8_t> data,
+                                                           std::size_t payload_size,
+                                                           std::size_t& consumed)
+{
+  consumed = 0;
+  while (consumed < data.size()) {
+    const auto remaining = data.subspan(consumed);
+
+    // Fast path: validate a whole run of headers first, then copy without any further checks
+    const auto count = count_continuation_payloads(remaining, payload_size);
+    const std::size_t header_len = remaining[0];
+    const auto data_size = payload_size - header_len;
+    if (count != 0 && frame_len_ + count * data_size <= frame_capacity_) {
+      const std::uint8_t* src = remaining.data() + header_len;
+      for (std::size_t i = 0; i != count; ++i, src += payload_size)
+        append(src, data_size);
+
+      // Just like put(), the frame keeps the last SCR it received
+      if (header_len >= 12) {
+        for (std::size_t i = count; i-- != 0;) {
+          const auto header = remaining.data() + i * payload_size;
+          if (0 != (header[1] & UVC_STREAM_SCR)) {
+            read_scr(header);
+            break;
+          }
+        }
+      }
+      consumed += count * payload_size;
+      continue;
+    }
+
+    // Anything else (frame boundaries, errors, overflows) goes through the regular path
+    const auto payload = remaining.subspan(0, std::min(payload_size, remaining.size()));
+    const auto result = put(payload);
+    if (result == status::need_buffer)
+      return result;
 
+    consumed += payload.size();
+    if (result == status::frame_complete)
+      return result;
+  }
   return status::need_data;
 }
 
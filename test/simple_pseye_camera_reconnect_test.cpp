@@ -0,0 +1,156 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/simple_pseye_camera.hpp"
+#include "pseye/exception.hpp"
+
+#include <libusb.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+
+using namespace pseye;
+
+#define CHECK(expr)                                                                                                    \
+  do {                                                                                                                 \
+    if (!(expr)) {                                                                                                     \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr);                                   \
+      std::exit(EXIT_FAILURE);                                                                                         \
+    }                                                                                                                  \
+  } while (false)
+
+namespace
+{
+
+struct transport_log
+{
+  std::atomic<int> num_started = 0;
+  std::atomic<int> num_stopped = 0;
+  std::atomic<int> num_reopened = 0;
+};
+
+// Never delivers data, stop() fails just like usb_camera_transport's did on an unplugged device
+class fake_transport final : public camera_transport
+{
+public:
+  fake_transport(transport_log& log, bool fail_stop)
+    : log_(log)
+    , fail_stop_(fail_stop)
+  {
+  }
+
+  camera_stream_layout configure(pseye_device_state&, const usb_stream_options&) override
+  {
+    camera_stream_layout layout;
+    layout.payload_size = ov534::bulk_payload_size;
+    return layout;
+  }
+  void start() override { ++log_.num_started; }
+  void stop() override
+  {
+    ++log_.num_stopped;
+    if (fail_stop_)
+      throw camera_bridge_error(LIBUSB_ERROR_NO_DEVICE, "bridge register write failed");
+  }
+  void release_buffer(std::uint8_t*) override {}
+
+  void lose_device()
+  {
+    usb_recovery_info info;
+    info.event = usb_recovery_event::device_lost;
+    recovery_handler_(recovery_handler_ctx_, info);
+  }
+
+private:
+  transport_log& log_;
+  bool fail_stop_;
+};
+
+template <typename Predicate>
+bool wait_for(Predicate predicate)
+{
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!predicate()) {
+    if (std::chrono::steady_clock::now() > deadline)
+      return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+void test_reconnect_survives_failing_stop()
+{
+  transport_log log;
+  auto transport = std::make_unique<fake_transport>(log, true);
+  const auto lost = transport.get();
+
+  simple_pseye_camera camera(std::move(transport), pseye_device_state{});
+  camera.start(size_mode::qvga, 30);
+  CHECK(log.num_started == 1);
+
+  usb_reconnect_policy policy;
+  policy.retry_interval = std::chrono::milliseconds(5);
+  policy.reopen = [](void* ctx) -> std::unique_ptr<camera_transport> {
+    auto& log = *static_cast<transport_log*>(ctx);
+    // The first attempt finds nothing, just like a camera that didn't enumerate yet
+    if (log.num_reopened++ == 0)
+      return nullptr;
+    return std::make_unique<fake_transport>(log, false);
+  };
+  policy.reopen_ctx = &log;
+  camera.enable_reconnect(policy);
+
+  lost->lose_device();
+  CHECK(wait_for([&] { return log.num_started == 2; }));
+  CHECK(log.num_stopped == 1);
+  CHECK(log.num_reopened == 2);
+  CHECK(camera.is_active());
+
+  camera.stop();
+  CHECK(log.num_stopped == 2);
+  CHECK(!camera.is_active());
+}
+
+void test_stop_error_is_reported_once()
+{
+  transport_log log;
+  simple_pseye_camera camera(std::make_unique<fake_transport>(log, true), pseye_device_state{});
+  camera.start(size_mode::qvga, 30);
+
+  bool thrown = false;
+  try {
+    camera.stop();
+  } catch (const camera_bridge_error&) {
+    thrown = true;
+  }
+  CHECK(thrown);
+  CHECK(!camera.is_active());
+
+  // The destructor must not try (and fail) again
+  camera.stop();
+  CHECK(log.num_stopped == 1);
+}
+
+} // namespace
+
+int main()
+{
+  test_reconnect_survives_failing_stop();
+  test_stop_error_is_reported_once();
+  return EXIT_SUCCESS;
+}
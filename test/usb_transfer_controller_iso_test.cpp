@@ -0,0 +1,146 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "pseye/driver/usb_transfer_controller.hpp"
+
+#include <libusb.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace pseye;
+
+#define CHECK(expr)                                                                                                    \
+  do {                                                                                                                 \
+    if (!(expr)) {                                                                                                     \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr);                                   \
+      std::exit(EXIT_FAILURE);                                                                                         \
+    }                                                                                                                  \
+  } while (false)
+
+namespace
+{
+
+constexpr int num_packets = 6;
+constexpr unsigned int packet_size = 64;
+
+struct packet
+{
+  unsigned int actual_length;
+  libusb_transfer_status status;
+};
+
+// Each packet's data is filled with its index, so we can tell them apart on the receiving end
+std::unique_ptr<libusb_transfer, free_libusb_transfer> make_iso_completion(std::vector<std::uint8_t>& buffer,
+                                                                           const packet (&packets)[num_packets])
+{
+  std::unique_ptr<libusb_transfer, free_libusb_transfer> transfer(::libusb_alloc_transfer(num_packets));
+  CHECK(transfer);
+  buffer.assign(num_packets * packet_size, 0xff);
+  transfer->buffer = buffer.data();
+  transfer->length = static_cast<int>(buffer.size());
+  transfer->num_iso_packets = num_packets;
+  transfer->status = LIBUSB_TRANSFER_COMPLETED;
+  ::libusb_set_iso_packet_lengths(transfer.get(), packet_size);
+  for (int i = 0; i < num_packets; ++i) {
+    transfer->iso_packet_desc[i].actual_length = packets[i].actual_length;
+    transfer->iso_packet_desc[i].status = packets[i].status;
+    std::memset(&buffer[i * packet_size], i, packets[i].actual_length);
+  }
+  return transfer;
+}
+
+struct received_packets
+{
+  std::vector<std::vector<std::uint8_t>> payloads;
+
+  static void on_data(void* ctx, std::span<std::uint8_t> data)
+  {
+    static_cast<received_packets*>(ctx)->payloads.emplace_back(data.begin(), data.end());
+  }
+};
+
+bool is_packet(const std::vector<std::uint8_t>& payload, int index, unsigned int length)
+{
+  if (payload.size() != length)
+    return false;
+  for (const auto byte : payload) {
+    if (byte != index)
+      return false;
+  }
+  return true;
+}
+
+void test_packets_are_delivered_separately()
+{
+  const packet packets[num_packets] = {
+      {packet_size, LIBUSB_TRANSFER_COMPLETED},
+      {         12, LIBUSB_TRANSFER_COMPLETED},
+      {packet_size, LIBUSB_TRANSFER_COMPLETED},
+      {          1, LIBUSB_TRANSFER_COMPLETED},
+      {         40, LIBUSB_TRANSFER_COMPLETED},
+      {packet_size, LIBUSB_TRANSFER_COMPLETED},
+  };
+  std::vector<std::uint8_t> buffer;
+  const auto transfer = make_iso_completion(buffer, packets);
+
+  received_packets received;
+  std::uint64_t num_bad_packets = 0;
+  const auto num_bytes = usb_transfer_controller::deliver_iso_packets(transfer.get(), &received_packets::on_data,
+                                                                      &received, num_bad_packets);
+
+  CHECK(num_bad_packets == 0);
+  CHECK(num_bytes == 3 * packet_size + 12 + 1 + 40);
+  CHECK(received.payloads.size() == num_packets);
+  for (int i = 0; i < num_packets; ++i)
+    CHECK(is_packet(received.payloads[i], i, packets[i].actual_length));
+}
+
+void test_bad_and_empty_packets_are_skipped()
+{
+  const packet packets[num_packets] = {
+      {packet_size, LIBUSB_TRANSFER_COMPLETED},
+      {packet_size,     LIBUSB_TRANSFER_ERROR},
+      {          0, LIBUSB_TRANSFER_COMPLETED},
+      {         20, LIBUSB_TRANSFER_COMPLETED},
+      {         30,  LIBUSB_TRANSFER_OVERFLOW},
+      {packet_size, LIBUSB_TRANSFER_COMPLETED},
+  };
+  std::vector<std::uint8_t> buffer;
+  const auto transfer = make_iso_completion(buffer, packets);
+
+  received_packets received;
+  std::uint64_t num_bad_packets = 0;
+  const auto num_bytes = usb_transfer_controller::deliver_iso_packets(transfer.get(), &received_packets::on_data,
+                                                                      &received, num_bad_packets);
+
+  CHECK(num_bad_packets == 2);
+  CHECK(num_bytes == 2 * packet_size + 20);
+  CHECK(received.payloads.size() == 3);
+  CHECK(is_packet(received.payloads[0], 0, packet_size));
+  CHECK(is_packet(received.payloads[1], 3, 20));
+  CHECK(is_packet(received.payloads[2], 5, packet_size));
+}
+
+} // namespace
+
+int main()
+{
+  test_packets_are_delivered_separately();
+  test_bad_and_empty_packets_are_skipped();
+  return EXIT_SUCCESS;
+}